@@ -5,11 +5,12 @@ RTCRayHitModel::RTCRayHitModel()
 = default;
 
 
-RTCRayHitModel::RTCRayHitModel(const RTCRayHit& ray_hit, const RTCScene* ray_scene, const float& current_ior)
+RTCRayHitModel::RTCRayHitModel(const RTCRayHit& ray_hit, const MeshAttributes* mesh_attributes, const MaterialTable* material_table, const float& current_ior)
 {
 	n1 = current_ior;
 	core = ray_hit;
-	scene = ray_scene;
+	attributes = mesh_attributes;
+	materials = material_table;
 	from = Vector3(ray_hit.ray.org_x, ray_hit.ray.org_y, ray_hit.ray.org_z);
 	dir = Vector3(ray_hit.ray.dir_x, ray_hit.ray.dir_y, ray_hit.ray.dir_z);
 	dir.Normalize();
@@ -19,45 +20,62 @@ RTCRayHitModel::RTCRayHitModel(const RTCRayHit& ray_hit, const RTCScene* ray_sce
 		load_geometry_data();
 }
 
+RTCRayHitModel::RTCRayHitModel(const RTCRayHit& ray_hit, const MaterialTable* material_table, const float& current_ior,
+	const Normal3f& interpolated_normal, const Coord2f& interpolated_tex_coord)
+{
+	n1 = current_ior;
+	core = ray_hit;
+	materials = material_table;
+	from = Vector3(ray_hit.ray.org_x, ray_hit.ray.org_y, ray_hit.ray.org_z);
+	dir = Vector3(ray_hit.ray.dir_x, ray_hit.ray.dir_y, ray_hit.ray.dir_z);
+	dir.Normalize();
+	hit = from + ray_hit.ray.tfar * Vector3(ray_hit.ray.dir_x, ray_hit.ray.dir_y, ray_hit.ray.dir_z);
+	roulette = false;
+	raw_normal = interpolated_normal;
+	tex_coord = interpolated_tex_coord;
+	load_hit_data();
+}
+
 void RTCRayHitModel::load_geometry_data()
 {
-	// we hit something
-	geometry = rtcGetGeometry(*scene, core.hit.geomID);
+	// we hit something, interpolate normal and texture coordinates
+	attributes->Interpolate(core.hit, raw_normal, tex_coord);
+	load_hit_data();
+}
 
-	// get interpolated normal
-	rtcInterpolate0(geometry, core.hit.primID, core.hit.u, core.hit.v, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0, &raw_normal.x, 3);
+void RTCRayHitModel::load_hit_data()
+{
 	normal = { raw_normal.x, raw_normal.y, raw_normal.z };
 	if (normal.DotProduct(-dir) < 0)
 		normal = -normal;
 
-	rtcInterpolate0(geometry, core.hit.primID, core.hit.u, core.hit.v, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 1, &tex_coord.u, 2);
-
-	material = static_cast<Material*>(rtcGetGeometryUserData(geometry));
+	material = materials->geometry_material(core.hit.geomID);
+	flags = materials->flags[material];
 
-	n2 = n1 > IOR_AIR ? IOR_AIR : material->ior;
+	n2 = n1 > IOR_AIR ? IOR_AIR : ior();
 
 	load_material();
 
 	rouletteRho = colorDiffuse.LargestValue();
-	roulette = !(material->isMirror() || material->isTransparent());
+	roulette = !(is_mirror() || is_transparent());
 }
 
 void RTCRayHitModel::load_material()
 {
 	// Get Difuse
-	if (material != nullptr)
+	if (material >= 0)
 	{
-		colorDiffuse = material->diffuse;
-		Texture* diffuse = material->get_texture(material->kDiffuseMapSlot);
-		if (diffuse != nullptr)
+		colorDiffuse = materials->diffuse[material];
+		const int diffuse = materials->diffuse_map[material];
+		if (diffuse >= 0)
 		{
-			Color3f texlet = diffuse->get_texel(tex_coord.u, 1.0f - tex_coord.v);
+			Color3f texlet = materials->textures[diffuse]->get_texel(tex_coord.u, 1.0f - tex_coord.v);
 			colorDiffuse.x = texlet.r;
 			colorDiffuse.y = texlet.g;
 			colorDiffuse.z = texlet.b;
 		}
 
-		colorSpecular = material->specular;
+		colorSpecular = materials->specular[material];
 	}
 }
 
@@ -78,7 +96,7 @@ void RTCRayHitModel::calc_fresnel()
 {
 	calc_reflection();
 	calc_refraction();
-	if (material->isMirror())
+	if (is_mirror())
 		R = 1;
 	else
 	{
@@ -113,6 +131,6 @@ Vector3 RTCRayHitModel::calc_result_color(const float& distance)
 {
 	Vector3 color = (colorRefracted * (1.f - R) + colorReflected * R);
 	if (distance >= 0)
-		color = color * material->attenuation.Exp(-distance);
+		color = color * attenuation().Exp(-distance);
 	return color;
 }
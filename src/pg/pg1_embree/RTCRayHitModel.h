@@ -1,7 +1,8 @@
 ﻿#pragma once
 #include "vector3.h"
 #include "structs.h"
-#include "material.h"
+#include "materialtable.h"
+#include "meshattributes.h"
 #include "simpleguidx11.h"
 
 class RTCRayHitModel
@@ -9,8 +10,11 @@ class RTCRayHitModel
 public:
 	RTCRayHitModel();
 
-	RTCRayHitModel(const RTCRayHit& ray_hit, const RTCScene* ray_scene, const float& current_ior);
+	RTCRayHitModel(const RTCRayHit& ray_hit, const MeshAttributes* mesh_attributes, const MaterialTable* material_table, const float& current_ior);
+	RTCRayHitModel(const RTCRayHit& ray_hit, const MaterialTable* material_table, const float& current_ior,
+		const Normal3f& interpolated_normal, const Coord2f& interpolated_tex_coord);
 	void load_geometry_data();
+	void load_hit_data();
 	
 	void calc_reflection();
 	void calc_refraction();
@@ -20,21 +24,33 @@ public:
 	Vector3 calc_result_color(const float& distance);
 
 	RTCRayHit core{};
-	const RTCScene* scene{};
-	RTCGeometry geometry{};
+	const MeshAttributes* attributes{};
 	Vector3 from;
 	Vector3 dir;
 	Vector3 hit;
 	Vector3 normal;
 	Normal3f raw_normal{};
 	Coord2f tex_coord{};
-	Material* material{};
+	const MaterialTable* materials{};
+	int material{ -1 }; // index into materials
+	unsigned char flags{};
+
+	bool is_mirror() const { return (flags & kMaterialMirror) != 0; }
+	bool is_reflective() const { return (flags & kMaterialReflective) != 0; }
+	bool is_transparent() const { return (flags & kMaterialTransparent) != 0; }
+	int shader() const { return materials->shader[material]; }
+	const Vector3& ambient() const { return materials->ambient[material]; }
+	const Vector3& emission() const { return materials->emission[material]; }
+	const Vector3& attenuation() const { return materials->attenuation[material]; }
+	float shininess() const { return materials->shininess[material]; }
+	float ior() const { return materials->ior[material]; }
 
 	float R;
 	Vector3 reflected;
 	Vector3 refracted;
 	float n1;
 	float n2;
+	float throughput{ 1 }; // weight of this hit in the pixel, product of the branch weights from the camera
 
 	Vector3 colorRefracted;
 	Vector3 colorReflected;
@@ -0,0 +1,89 @@
+#include "stdafx.h"
+#include "animation.h"
+#include "mymath.h"
+#include <algorithm>
+#include <sstream>
+
+bool Animation::Load(const std::string& file_name)
+{
+	Clear();
+
+	std::ifstream file(file_name);
+	if (!file.is_open())
+		return false;
+
+	std::string text;
+	for (int line = 1; std::getline(file, text); ++line)
+	{
+		const size_t start = text.find_first_not_of(" \t\r");
+		if (start == std::string::npos || text[start] == '#')
+			continue;
+
+		std::istringstream values(text);
+		std::string name;
+		Keyframe key;
+		if (!(values >> name >> key.time >> key.translation.x >> key.translation.y >> key.translation.z
+			>> key.rotation.x >> key.rotation.y >> key.rotation.z >> key.scale))
+		{
+			printf("%s(%d): expected <object> <time> <tx> <ty> <tz> <rx> <ry> <rz> <scale>\n", file_name.c_str(), line);
+			Clear();
+			return false;
+		}
+
+		tracks_[name].push_back(key);
+	}
+
+	for (auto& track : tracks_)
+		std::stable_sort(track.second.begin(), track.second.end(),
+			[](const Keyframe& a, const Keyframe& b) { return a.time < b.time; });
+
+	printf("Animation: %d objects, %.2f s\n", static_cast<int>(tracks_.size()), duration());
+	return true;
+}
+
+void Animation::Clear()
+{
+	tracks_.clear();
+}
+
+bool Animation::empty() const
+{
+	return tracks_.empty();
+}
+
+float Animation::duration() const
+{
+	float duration = 0;
+	for (const auto& track : tracks_)
+		duration = max(duration, track.second.back().time);
+	return duration;
+}
+
+const std::vector<Keyframe>* Animation::track(const std::string& name) const
+{
+	const auto track = tracks_.find(name);
+	return track == tracks_.end() ? nullptr : &track->second;
+}
+
+void Animation::Evaluate(const std::vector<Keyframe>& keys, const float time, Matrix3x3& rotation, Vector3& translation, float& scale)
+{
+	// first key after the time, the pair around it is blended
+	size_t next = 0;
+	while (next < keys.size() && keys[next].time <= time)
+		++next;
+
+	const Keyframe& a = keys[next == 0 ? 0 : next - 1];
+	const Keyframe& b = keys[next == keys.size() ? keys.size() - 1 : next];
+	const float span = b.time - a.time;
+	const float w = span > 0 ? (time - a.time) / span : 0.0f;
+
+	translation = a.translation * (1 - w) + b.translation * w;
+	scale = a.scale * (1 - w) + b.scale * w;
+	const Vector3 angles = a.rotation * (1 - w) + b.rotation * w;
+
+	const float x = deg2rad(angles.x), y = deg2rad(angles.y), z = deg2rad(angles.z);
+	const Matrix3x3 rx(1, 0, 0, 0, cosf(x), -sinf(x), 0, sinf(x), cosf(x));
+	const Matrix3x3 ry(cosf(y), 0, sinf(y), 0, 1, 0, -sinf(y), 0, cosf(y));
+	const Matrix3x3 rz(cosf(z), -sinf(z), 0, sinf(z), cosf(z), 0, 0, 0, 1);
+	rotation = rz * ry * rx;
+}
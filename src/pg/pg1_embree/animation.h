@@ -0,0 +1,44 @@
+#pragma once
+#include "vector3.h"
+#include "matrix3x3.h"
+
+/*! \struct Keyframe
+\brief Transform of an object at one point in time.
+*/
+struct Keyframe
+{
+	float time; // seconds
+	Vector3 translation;
+	Vector3 rotation; // degrees around x, y and z, applied in this order
+	float scale;
+};
+
+/*! \class Animation
+\brief Keyframed rigid transforms of scene objects.
+
+Tracks are read from a text file next to the scene (scene.anim for scene.obj),
+every non-empty line not starting with # is one keyframe:
+
+<object name> <time> <tx> <ty> <tz> <rx> <ry> <rz> <scale>
+
+The object name is the group name of the surface in the OBJ file. Objects are
+rotated and scaled around the center of their bounding box and translated
+afterwards, keys are interpolated linearly and held before the first and after
+the last one.
+*/
+class Animation
+{
+public:
+	bool Load(const std::string& file_name);
+	void Clear();
+	bool empty() const;
+	float duration() const;
+
+	//! Keyframes of the given object sorted by time, nullptr for static objects.
+	const std::vector<Keyframe>* track(const std::string& name) const;
+
+	static void Evaluate(const std::vector<Keyframe>& keys, const float time, Matrix3x3& rotation, Vector3& translation, float& scale);
+
+private:
+	std::map<std::string, std::vector<Keyframe>> tracks_;
+};
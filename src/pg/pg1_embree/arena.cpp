@@ -0,0 +1,128 @@
+#include "stdafx.h"
+#include "arena.h"
+
+Arena::Arena( const size_t block_size ) : block_size_( block_size )
+{
+}
+
+Arena::~Arena()
+{
+	Release();
+}
+
+char * Arena::Data( Block * block ) const
+{
+	return reinterpret_cast<char *>( block ) + sizeof( Block );
+}
+
+bool Arena::Fits( const size_t size, const size_t alignment ) const
+{
+	if ( current_ == nullptr )
+		return false;
+	const uintptr_t address = reinterpret_cast<uintptr_t>( Data( current_ ) ) + offset_;
+	const size_t padding = ( alignment - address % alignment ) % alignment;
+	return offset_ + padding + size <= current_->size;
+}
+
+void * Arena::Allocate( const size_t size, const size_t alignment )
+{
+	if ( !Fits( size, alignment ) )
+	{
+		// blocks left by Reset() are reused before new ones are allocated
+		Block * block = current_ != nullptr ? current_->next : first_;
+		if ( block == nullptr || block->size < size + alignment )
+		{
+			const size_t block_size = max( block_size_, size + alignment );
+			Block * fresh = static_cast<Block *>( malloc( sizeof( Block ) + block_size ) );
+			if ( fresh == nullptr )
+				throw std::bad_alloc();
+			fresh->size = block_size;
+			fresh->next = block;
+			if ( current_ != nullptr )
+				current_->next = fresh;
+			else
+				first_ = fresh;
+			block = fresh;
+		}
+		current_ = block;
+		offset_ = 0;
+	}
+
+	const uintptr_t address = reinterpret_cast<uintptr_t>( Data( current_ ) ) + offset_;
+	const size_t padding = ( alignment - address % alignment ) % alignment;
+	offset_ += padding + size;
+	used_ += size;
+	return reinterpret_cast<void *>( address + padding );
+}
+
+void Arena::AddFinalizer( void ( *destroy )( void * ), void * object )
+{
+	Finalizer * finalizer = static_cast<Finalizer *>( Allocate( sizeof( Finalizer ), alignof( Finalizer ) ) );
+	finalizer->destroy = destroy;
+	finalizer->object = object;
+	finalizer->next = finalizers_;
+	finalizers_ = finalizer;
+}
+
+void Arena::RunFinalizers()
+{
+	for ( Finalizer * finalizer = finalizers_; finalizer != nullptr; finalizer = finalizer->next )
+		finalizer->destroy( finalizer->object );
+	finalizers_ = nullptr;
+}
+
+void Arena::Reset()
+{
+	RunFinalizers();
+	current_ = first_;
+	offset_ = 0;
+	used_ = 0;
+}
+
+void Arena::Release()
+{
+	RunFinalizers();
+	while ( first_ != nullptr )
+	{
+		Block * next = first_->next;
+		free( first_ );
+		first_ = next;
+	}
+	current_ = nullptr;
+	offset_ = 0;
+	used_ = 0;
+}
+
+size_t Arena::used() const
+{
+	return used_;
+}
+
+size_t Arena::capacity() const
+{
+	size_t capacity = 0;
+	for ( Block * block = first_; block != nullptr; block = block->next )
+		capacity += block->size;
+	return capacity;
+}
+
+static std::atomic<unsigned int> scratch_pass{ 0 };
+
+Arena & ScratchArena()
+{
+	static thread_local Arena arena( 1024 * 1024 );
+	static thread_local unsigned int pass = 0;
+
+	const unsigned int current = scratch_pass.load( std::memory_order_acquire );
+	if ( pass != current )
+	{
+		arena.Reset();
+		pass = current;
+	}
+	return arena;
+}
+
+void NextScratchPass()
+{
+	scratch_pass.fetch_add( 1, std::memory_order_acq_rel );
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*! \class Arena
+\brief Bump allocator handing out memory from a list of large blocks.
+
+Objects are never freed one by one. Reset() runs the destructors of the
+objects created by New() in reverse order and rewinds to the first block,
+keeping its memory for the next use, Release() also returns all blocks to the
+system. Requests larger than the block size get a block of their own. An arena
+is not thread safe, every thread uses its own one.
+*/
+class Arena
+{
+public:
+	explicit Arena( const size_t block_size = 64 * 1024 );
+	~Arena();
+
+	Arena( const Arena & ) = delete;
+	Arena & operator=( const Arena & ) = delete;
+
+	void * Allocate( const size_t size, const size_t alignment = alignof( std::max_align_t ) );
+
+	// the destructor runs at Reset() or Release() unless T is trivially destructible
+	template <class T, class... Args> T * New( Args &&... args )
+	{
+		T * object = new ( Allocate( sizeof( T ), alignof( T ) ) ) T( std::forward<Args>( args )... );
+		if ( !std::is_trivially_destructible<T>::value )
+			AddFinalizer( &Destroy<T>, object );
+		return object;
+	}
+
+	// default constructed elements, only for types without a destructor
+	template <class T> T * NewArray( const size_t count )
+	{
+		static_assert( std::is_trivially_destructible<T>::value, "arena arrays are not destructed" );
+		T * array = static_cast<T *>( Allocate( sizeof( T ) * count, alignof( T ) ) );
+		for ( size_t i = 0; i < count; ++i )
+			new ( &array[i] ) T();
+		return array;
+	}
+
+	void Reset();
+	void Release();
+
+	size_t used() const; // bytes handed out since the last reset
+	size_t capacity() const; // bytes of all blocks
+
+private:
+	struct Block
+	{
+		Block * next;
+		size_t size; // usable bytes after the header
+	};
+
+	struct Finalizer
+	{
+		void ( *destroy )( void * );
+		void * object;
+		Finalizer * next;
+	};
+
+	template <class T> static void Destroy( void * object )
+	{
+		static_cast<T *>( object )->~T();
+	}
+
+	void AddFinalizer( void ( *destroy )( void * ), void * object );
+	void RunFinalizers();
+	bool Fits( const size_t size, const size_t alignment ) const;
+	char * Data( Block * block ) const;
+
+	size_t block_size_;
+	Block * first_{ nullptr }; // kept by Reset()
+	Block * current_{ nullptr };
+	size_t offset_{ 0 }; // into the current block
+	size_t used_{ 0 };
+	Finalizer * finalizers_{ nullptr }; // newest first
+};
+
+/*! \fn Arena & ScratchArena()
+\brief Arena of the calling thread for data that lives at most until the end of a pass.
+
+The arena is reset the first time a thread asks for it after NextScratchPass(),
+so render threads never share an allocator and never free anything themselves.
+*/
+Arena & ScratchArena();
+
+/*! \fn void NextScratchPass()
+\brief Invalidates the scratch memory of all threads, called between passes when no scratch data is in use.
+*/
+void NextScratchPass();
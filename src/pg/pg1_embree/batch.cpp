@@ -0,0 +1,271 @@
+#include "stdafx.h"
+#include "batch.h"
+#include "raytracer.h"
+#include "imagewriter.h"
+#include "mymath.h"
+#include <sstream>
+#include <algorithm>
+#include <memory>
+
+namespace
+{
+	struct BatchJob
+	{
+		int line;
+		std::string scene;
+		std::string output;
+		int width{ 320 };
+		int height{ 240 };
+		float fov_y{ 40.0f }; // degrees
+		Vector3 view_from{ 40, -940, 250 };
+		Vector3 view_at{ 0, 0, 250 };
+		Vector3 light{ 157, -157, 105 };
+		Vector3 light_power{ 1, 1, 1 };
+		std::string mode{ "phong_shadows" };
+		int passes{ 1 };
+		float time{ 0.0f }; // seconds
+		unsigned int seed{ 0 };
+		int ss{ 0 };
+		bool adaptive{ false };
+		int path_samples{ 2 };
+		bool sky{ true };
+		int frames{ 1 };
+		float fps{ 24.0f };
+		float start{ 0.0f }; // seconds
+		int motion_steps{ 1 };
+		float shutter{ 0.5f }; // fraction of a frame
+	};
+
+	struct BatchMode
+	{
+		const char * name;
+		int shader; // Raytracer::shaderSelected
+		bool shadows;
+		bool reflections; // reflections and refractions
+		bool path;
+		bool path_deep;
+	};
+
+	const BatchMode kModes[] = {
+		{ "normal", 0, false, false, false, false },
+		{ "lambert", 3, false, false, false, false },
+		{ "phong", 4, false, false, false, false },
+		{ "phong_shadows", 4, true, false, false, false },
+		{ "whitted", 4, true, true, false, false },
+		{ "path", 4, true, false, true, false },
+		{ "path_deep", 4, true, false, true, true },
+	};
+
+	const BatchMode * FindMode( const std::string & name )
+	{
+		for ( const BatchMode & mode : kModes )
+			if ( name == mode.name )
+				return &mode;
+		return nullptr;
+	}
+
+	bool ParseVector( const std::string & value, Vector3 & vector )
+	{
+		return sscanf( value.c_str(), "%f,%f,%f", &vector.x, &vector.y, &vector.z ) == 3;
+	}
+
+	bool ParseJob( const std::string & text, const int line, BatchJob & job )
+	{
+		job.line = line;
+		std::istringstream tokens( text );
+		std::string token;
+
+		while ( tokens >> token )
+		{
+			const size_t equals = token.find( '=' );
+			if ( equals == std::string::npos )
+			{
+				printf( "line %d: expected key=value, got %s\n", line, token.c_str() );
+				return false;
+			}
+
+			const std::string key = token.substr( 0, equals );
+			const std::string value = token.substr( equals + 1 );
+			bool valid = true;
+
+			if ( key == "scene" ) job.scene = value;
+			else if ( key == "output" ) job.output = value;
+			else if ( key == "width" ) valid = ( job.width = atoi( value.c_str() ) ) > 0;
+			else if ( key == "height" ) valid = ( job.height = atoi( value.c_str() ) ) > 0;
+			else if ( key == "fov" ) valid = ( job.fov_y = static_cast<float>( atof( value.c_str() ) ) ) > 0;
+			else if ( key == "from" ) valid = ParseVector( value, job.view_from );
+			else if ( key == "at" ) valid = ParseVector( value, job.view_at );
+			else if ( key == "light" ) valid = ParseVector( value, job.light );
+			else if ( key == "light_power" ) valid = ParseVector( value, job.light_power );
+			else if ( key == "mode" ) valid = FindMode( job.mode = value ) != nullptr;
+			else if ( key == "passes" ) valid = ( job.passes = atoi( value.c_str() ) ) >= 0;
+			else if ( key == "time" ) valid = ( job.time = static_cast<float>( atof( value.c_str() ) ) ) >= 0;
+			else if ( key == "seed" ) job.seed = static_cast<unsigned int>( strtoul( value.c_str(), nullptr, 10 ) );
+			else if ( key == "ss" ) valid = ( job.ss = atoi( value.c_str() ) ) >= 0;
+			else if ( key == "adaptive" ) job.adaptive = atoi( value.c_str() ) != 0;
+			else if ( key == "path_samples" ) valid = ( job.path_samples = atoi( value.c_str() ) ) > 0;
+			else if ( key == "sky" ) job.sky = atoi( value.c_str() ) != 0;
+			else if ( key == "frames" ) valid = ( job.frames = atoi( value.c_str() ) ) > 0;
+			else if ( key == "fps" ) valid = ( job.fps = static_cast<float>( atof( value.c_str() ) ) ) > 0;
+			else if ( key == "start" ) job.start = static_cast<float>( atof( value.c_str() ) );
+			else if ( key == "motion_steps" ) valid = ( job.motion_steps = atoi( value.c_str() ) ) > 0;
+			else if ( key == "shutter" ) valid = ( job.shutter = static_cast<float>( atof( value.c_str() ) ) ) >= 0;
+			else
+			{
+				printf( "line %d: unknown key %s\n", line, key.c_str() );
+				return false;
+			}
+
+			if ( !valid )
+			{
+				printf( "line %d: invalid %s=%s\n", line, key.c_str(), value.c_str() );
+				return false;
+			}
+		}
+
+		if ( job.scene.empty() || job.output.empty() )
+		{
+			printf( "line %d: scene and output are required\n", line );
+			return false;
+		}
+
+		if ( job.passes == 0 && job.time == 0 )
+		{
+			printf( "line %d: passes or time has to be set\n", line );
+			return false;
+		}
+
+		return true;
+	}
+
+	bool ReadJobs( const char * job_file, std::vector<BatchJob> & jobs )
+	{
+		std::ifstream file( job_file );
+		if ( !file.is_open() )
+		{
+			printf( "Unable to open %s\n", job_file );
+			return false;
+		}
+
+		std::string text;
+		for ( int line = 1; std::getline( file, text ); ++line )
+		{
+			const size_t start = text.find_first_not_of( " \t\r" );
+			if ( start == std::string::npos || text[start] == '#' )
+				continue;
+
+			BatchJob job;
+			if ( !ParseJob( text, line, job ) )
+				return false;
+			jobs.push_back( job );
+		}
+
+		return true;
+	}
+
+	void SetupMode( Raytracer & raytracer, const BatchJob & job )
+	{
+		const BatchMode & mode = *FindMode( job.mode );
+		raytracer.shaderSelected = mode.shader;
+		raytracer.shadows_ = mode.shadows;
+		raytracer.refl_ = mode.reflections;
+		raytracer.refr_ = mode.reflections;
+		raytracer.RAY_MAX_BUMPS = mode.reflections ? 10 : 0;
+		raytracer.path_ = mode.path;
+		raytracer.path_deep_ = mode.path_deep;
+		raytracer.PATH_SAMPLES = job.path_samples;
+		raytracer.ss_ = job.ss;
+		raytracer.adaptive_ = job.adaptive;
+		raytracer.cubeMap_->returnTexture = job.sky;
+	}
+}
+
+int batch( const char * job_file, const char * config )
+{
+	std::vector<BatchJob> jobs;
+	if ( !ReadJobs( job_file, jobs ) )
+		return EXIT_FAILURE;
+
+	if ( jobs.empty() )
+	{
+		printf( "%s has no jobs\n", job_file );
+		return EXIT_SUCCESS;
+	}
+
+	// jobs of one scene run back to back, so every scene is built once
+	std::stable_sort( jobs.begin(), jobs.end(), []( const BatchJob & a, const BatchJob & b ) { return a.scene < b.scene; } );
+
+	std::unique_ptr<Raytracer> raytracer;
+	ImageWriter writer;
+
+	for ( const BatchJob & job : jobs )
+	{
+		if ( !raytracer )
+		{
+			Vector3 light = job.light;
+			Vector3 light_power = job.light_power;
+			Vector3 background( 1, 1, 1 );
+			raytracer.reset( new Raytracer( job.width, job.height, deg2rad( job.fov_y ), job.view_from, job.view_at,
+				&light, &light_power, &background, config, true ) );
+			raytracer->heatmaps_ = false;
+		}
+		else if ( raytracer->width() != job.width || raytracer->height() != job.height )
+			raytracer->Resize( job.width, job.height );
+
+		raytracer->SetView( deg2rad( job.fov_y ), job.view_from, job.view_at, job.light, job.light_power );
+
+		// the number of time steps is part of the Embree geometries
+		const std::string scene = job.scene + ";";
+		if ( raytracer->scene_file() != scene || raytracer->motion_steps_ != job.motion_steps )
+		{
+			if ( !raytracer->scene_file().empty() )
+				raytracer->UnloadScene();
+			raytracer->motion_steps_ = job.motion_steps;
+			raytracer->LoadScene( job.scene );
+			printf( "%s: load %.3f s, bvh %.3f s\n", job.scene.c_str(), raytracer->load_seconds_, raytracer->build_seconds_ );
+		}
+
+		SetupMode( *raytracer, job );
+		raytracer->accumulator_ = true;
+		raytracer->shutter_ = job.shutter / job.fps;
+
+		for ( int frame = 0; frame < job.frames; ++frame )
+		{
+			// applied by the first pass, only the animated objects are refit
+			raytracer->animation_time_ = job.start + frame / job.fps;
+			raytracer->ResetSequence( job.seed );
+			raytracer->ClearAccumulator();
+
+			const auto start = std::chrono::steady_clock::now();
+			int passes = 0;
+			double seconds = 0;
+			while ( ( job.passes == 0 || passes < job.passes ) && ( job.time == 0 || seconds < job.time ) )
+			{
+				raytracer->RenderHeadless( 1 );
+				passes++;
+				seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+			}
+
+			ImageWriter::Job image;
+			image.rgba.assign( raytracer->image(), raytracer->image() + job.width * job.height * 4 );
+			image.width = job.width;
+			image.height = job.height;
+			image.format = ImageWriter::format( job.output, image.file_name );
+			image.display = false;
+			if ( job.frames > 1 )
+			{
+				char number[16];
+				sprintf( number, "_%04d", frame );
+				image.file_name += number;
+			}
+			const std::string file_name = image.file_name + ImageWriter::extension( image.format );
+			writer.Submit( std::move( image ) );
+
+			printf( "line %d: %s, %s, %d passes in %.3f s -> %s\n", job.line, job.scene.c_str(), job.mode.c_str(), passes, seconds, file_name.c_str() );
+		}
+	}
+
+	// FreeImage is released with the raytracer
+	writer.Flush();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,26 @@
+#ifndef BATCH_H_
+#define BATCH_H_
+
+/*! \fn batch
+\brief Renders the jobs of a job file back to back without a window.
+
+Every non-empty line not starting with # is one job of key=value pairs:
+
+scene=<obj> output=<png|exr|pfm> width=320 height=240 fov=40 from=x,y,z at=x,y,z
+light=x,y,z light_power=r,g,b mode=phong_shadows passes=1 time=0 seed=0 ss=0 adaptive=0 path_samples=2 sky=1
+frames=1 fps=24 start=0 motion_steps=1 shutter=0.5
+
+mode is one of normal, lambert, phong, phong_shadows, whitted, path, path_deep.
+adaptive=1 supersamples only pixels on edges, ss then limits their samples.
+Rendering stops after passes passes or time seconds, whichever comes first, 0
+disables the limit. With frames > 1 an animation sequence is rendered from
+start seconds on, the frame number is appended to the output name and the BVH
+is only refit between frames. motion_steps > 1 enables motion blur over
+shutter (fraction of a frame). Jobs are grouped by scene, keeping their order otherwise,
+and a single headless raytracer is reused, so the Embree device and the
+environment map are created once and a scene is loaded and built only once for
+all jobs that render it.
+*/
+int batch( const char * job_file, const char * config = "threads=0,verbose=0" );
+
+#endif
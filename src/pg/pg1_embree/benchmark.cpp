@@ -0,0 +1,444 @@
+#include "stdafx.h"
+#include "benchmark.h"
+#include "raytracer.h"
+#include "mymath.h"
+
+namespace
+{
+	const int kWidth = 320;
+	const int kHeight = 240;
+	const unsigned int kSeed = 1234;
+	const char * kReferenceDirectory = "../../../data/benchmark/";
+
+	struct BenchmarkScene
+	{
+		const char * name;
+		const char * file_name;
+		float fov_y; // degrees
+		Vector3 view_from;
+		Vector3 view_at;
+		Vector3 light;
+		Vector3 light_power;
+	};
+
+	struct BenchmarkConfig
+	{
+		const char * name;
+		int passes;
+		void ( *setup )( Raytracer & raytracer );
+		const char * reference; // config whose reference image is compared, nullptr for its own
+	};
+
+	void SetupWhitted( Raytracer & raytracer )
+	{
+		raytracer.shaderSelected = 4;
+		raytracer.shadows_ = true;
+		raytracer.refl_ = true;
+		raytracer.refr_ = true;
+		raytracer.RAY_MAX_BUMPS = 10;
+		raytracer.path_ = false;
+	}
+
+	// deepest tree the UI allows, the ray stack must stay safe and bounded at this depth
+	void SetupWhittedDeep( Raytracer & raytracer )
+	{
+		SetupWhitted( raytracer );
+		raytracer.RAY_MAX_BUMPS = 20;
+	}
+
+	// neither pruning nor branch roulette, the complete ray tree is deterministic after one pass
+	void SetupWhittedFullTree( Raytracer & raytracer )
+	{
+		SetupWhitted( raytracer );
+		raytracer.prune_ = false;
+		raytracer.branch_roulette_ = false;
+	}
+
+	// has to converge to the full tree, a bias shows as an error that stops falling with more passes
+	void SetupWhittedBranchRoulette( Raytracer & raytracer )
+	{
+		SetupWhittedFullTree( raytracer );
+		raytracer.branch_roulette_ = true;
+	}
+
+	void SetupPhongShadows( Raytracer & raytracer )
+	{
+		raytracer.shaderSelected = 4;
+		raytracer.shadows_ = true;
+		raytracer.refl_ = false;
+		raytracer.refr_ = false;
+		raytracer.path_ = false;
+	}
+
+	void SetupPath( Raytracer & raytracer )
+	{
+		raytracer.shaderSelected = 4;
+		raytracer.shadows_ = true;
+		raytracer.refl_ = false;
+		raytracer.refr_ = false;
+		raytracer.RAY_MAX_BUMPS = 0;
+		raytracer.path_ = true;
+		raytracer.path_deep_ = false;
+		raytracer.PATH_SAMPLES = 1; // shallow mode draws PATH_SAMPLES + 1 samples at the first bounce
+		raytracer.PATH_MAX_BUMPS = 5;
+	}
+
+	// camera setups follow the tutorials
+	const BenchmarkScene kScenes[] = {
+		{ "cornell_box2", "../../../data/cornell_box2/cornell_box2.obj", 40.0f, Vector3( 40, -940, 250 ), Vector3( 0, 0, 250 ), Vector3( 157, -157, 105 ), Vector3( 1, 1, 1 ) },
+		{ "box_sphere", "../../../data/box_sphere/box_sphere.obj", 40.0f, Vector3( 40, -940, 250 ), Vector3( 0, 0, 250 ), Vector3( 157, -157, 105 ), Vector3( 1, 1, 1 ) },
+		{ "geosphere", "../../../data/geosphere/geosphere.obj", 45.0f, Vector3( 2, -3, 0 ), Vector3( 0, 0, 0 ), Vector3( 200, 300, 400 ), Vector3( 1, 1, 1 ) },
+		{ "geospheres_5x5", "../../../data/geospheres/geospheres_5x5.obj", 40.0f, Vector3( 10, 0, 20 ), Vector3( 0, 0, 0 ), Vector3( 200, 300, 400 ), Vector3( 1, 1, 1 ) },
+		{ "6887", "../../../data/6887/6887_allied_avenger.obj", 45.0f, Vector3( -125, -109, 24 ), Vector3( 0, 0, 35 ), Vector3( 200, 300, 400 ), Vector3( 1, 1, 1 ) },
+	};
+
+	const BenchmarkConfig kConfigs[] = {
+		{ "whitted", 1, SetupWhitted, nullptr },
+		{ "whitted_deep", 1, SetupWhittedDeep, nullptr },
+		{ "whitted_full_tree", 1, SetupWhittedFullTree, nullptr },
+		{ "whitted_branch_roulette_16", 16, SetupWhittedBranchRoulette, "whitted_full_tree" }, // the rmse halves
+		{ "whitted_branch_roulette_64", 64, SetupWhittedBranchRoulette, "whitted_full_tree" }, // from 16 to 64 passes
+		{ "phong_shadows", 1, SetupPhongShadows, nullptr },
+		{ "path_16spp", 8, SetupPath, nullptr }, // 8 passes x 2 samples
+	};
+
+	bool FileExists( const char * file_name )
+	{
+		FILE * file = fopen( file_name, "rb" );
+		if ( file == nullptr )
+			return false;
+		fclose( file );
+		return true;
+	}
+
+	// portable float map, RGB rows from bottom to top, little endian
+	bool WritePfm( const char * file_name, const float * rgba, const int width, const int height )
+	{
+		FILE * file = fopen( file_name, "wb" );
+		if ( file == nullptr )
+			return false;
+
+		fprintf( file, "PF\n%d %d\n-1.0\n", width, height );
+		std::vector<float> line( width * 3 );
+		for ( int y = height - 1; y >= 0; --y )
+		{
+			for ( int x = 0; x < width; ++x )
+				for ( int c = 0; c < 3; ++c )
+					line[x * 3 + c] = rgba[( y * width + x ) * 4 + c];
+			fwrite( line.data(), sizeof( float ), line.size(), file );
+		}
+
+		return fclose( file ) == 0;
+	}
+
+	bool ReadPfm( const char * file_name, std::vector<float> & rgb, int & width, int & height )
+	{
+		FILE * file = fopen( file_name, "rb" );
+		if ( file == nullptr )
+			return false;
+
+		char magic[3] = {};
+		float scale = 0;
+		const bool header = fscanf( file, "%2s %d %d %f", magic, &width, &height, &scale ) == 4 &&
+			strcmp( magic, "PF" ) == 0 && scale < 0 && width > 0 && height > 0;
+		fgetc( file ); // single whitespace after the header
+
+		bool read = false;
+		if ( header )
+		{
+			rgb.resize( width * height * 3 );
+			read = fread( rgb.data(), sizeof( float ), rgb.size(), file ) == rgb.size();
+		}
+
+		fclose( file );
+		return read;
+	}
+
+	// mean squared and relative mean squared error over RGB
+	void Mse( const float * rgba, const std::vector<float> & reference, const int width, const int height, double & mse, double & rel_mse )
+	{
+		double sum = 0, rel_sum = 0;
+		for ( int y = 0; y < height; ++y )
+			for ( int x = 0; x < width; ++x )
+				for ( int c = 0; c < 3; ++c )
+				{
+					const double r = reference[( ( height - 1 - y ) * width + x ) * 3 + c];
+					const double d = rgba[( y * width + x ) * 4 + c] - r;
+					sum += d * d;
+					rel_sum += d * d / ( r * r + 1e-2 );
+				}
+
+		const double count = width * height * 3.0;
+		mse = sum / count;
+		rel_mse = rel_sum / count;
+	}
+
+	// root mean square error over RGB, negative if the reference is unusable
+	double Rmse( const float * rgba, const std::vector<float> & reference, const int width, const int height )
+	{
+		if ( reference.size() != static_cast<size_t>( width * height * 3 ) )
+			return -1.0;
+
+		double sum = 0;
+		for ( int y = 0; y < height; ++y )
+			for ( int x = 0; x < width; ++x )
+				for ( int c = 0; c < 3; ++c )
+				{
+					// reference rows are stored bottom to top
+					const double d = rgba[( y * width + x ) * 4 + c] - reference[( ( height - 1 - y ) * width + x ) * 3 + c];
+					sum += d * d;
+				}
+
+		return sqrt( sum / ( width * height * 3.0 ) );
+	}
+}
+
+int benchmark( const char * output_file, const char * config, const bool write_references )
+{
+	FILE * json = fopen( output_file, "w" );
+	if ( json == nullptr )
+	{
+		printf( "Unable to open %s\n", output_file );
+		return EXIT_FAILURE;
+	}
+
+	fprintf( json, "{\n\"width\":%d,\"height\":%d,\"seed\":%u,\n\"results\":[\n", kWidth, kHeight, kSeed );
+	bool first = true;
+	int missing_references = 0; // reported, the run still succeeds
+
+	for ( const BenchmarkScene & scene : kScenes )
+		for ( const BenchmarkConfig & benchmark_config : kConfigs )
+		{
+			fprintf( json, "%s{\"scene\":\"%s\",\"config\":\"%s\"", first ? "" : ",\n", scene.name, benchmark_config.name );
+			first = false;
+
+			if ( !FileExists( scene.file_name ) )
+			{
+				printf( "%s: %s is missing, skipped\n", scene.name, scene.file_name );
+				fprintf( json, ",\"status\":\"skipped\"}" );
+				continue;
+			}
+
+			Vector3 light = scene.light;
+			Vector3 light_power = scene.light_power;
+			Vector3 background( 1, 1, 1 );
+			Raytracer raytracer( kWidth, kHeight, deg2rad( scene.fov_y ), scene.view_from, scene.view_at,
+				&light, &light_power, &background, config, true );
+
+			raytracer.seed_ = kSeed;
+			raytracer.ss_ = 0;
+			raytracer.accumulator_ = true;
+			raytracer.heatmaps_ = false;
+			raytracer.cubeMap_->returnTexture = true;
+			benchmark_config.setup( raytracer );
+
+			raytracer.LoadScene( scene.file_name );
+
+			const auto render_start = std::chrono::steady_clock::now();
+			raytracer.RenderHeadless( benchmark_config.passes );
+			const double render_seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - render_start ).count();
+
+			const unsigned long long rays = raytracer.rays_traced();
+			const double mrays = render_seconds > 0 ? rays / render_seconds * 1e-6 : 0.0;
+
+			// compare with the committed reference, references are only written on request
+			char reference_file[256];
+			sprintf( reference_file, "%s%s_%s.pfm", kReferenceDirectory, scene.name,
+				benchmark_config.reference != nullptr ? benchmark_config.reference : benchmark_config.name );
+			std::vector<float> reference;
+			int reference_width = 0, reference_height = 0;
+			double rmse = -1.0;
+			if ( write_references && benchmark_config.reference == nullptr )
+			{
+				if ( WritePfm( reference_file, raytracer.image(), kWidth, kHeight ) )
+					printf( "%s: reference %s written\n", scene.name, reference_file );
+				else
+					printf( "%s: unable to write %s\n", scene.name, reference_file );
+			}
+			else if ( ReadPfm( reference_file, reference, reference_width, reference_height ) &&
+				reference_width == kWidth && reference_height == kHeight )
+				rmse = Rmse( raytracer.image(), reference, kWidth, kHeight );
+			else
+			{
+				printf( "%s: reference %s is missing or has another size\n", scene.name, reference_file );
+				missing_references++;
+			}
+
+			printf( "%s/%s: load %.3f s, bvh %.3f s, render %.3f s, %.2f Mrays/s, rmse %.6f\n",
+				scene.name, benchmark_config.name, raytracer.load_seconds_, raytracer.build_seconds_,
+				render_seconds, mrays, rmse );
+
+			fprintf( json, ",\"status\":\"ok\",\"passes\":%d,\"load_s\":%.6f,\"bvh_s\":%.6f,\"render_s\":%.6f,\"rays\":%llu,\"mrays_per_second\":%.3f,",
+				benchmark_config.passes, raytracer.load_seconds_, raytracer.build_seconds_, render_seconds, rays, mrays );
+			if ( rmse >= 0 )
+				fprintf( json, "\"rmse\":%.8f}", rmse );
+			else
+				fprintf( json, "\"rmse\":null,\"reference\":\"missing\"}" );
+		}
+
+	fprintf( json, "\n]\n}\n" );
+	fclose( json );
+
+	printf( "Benchmark results written to %s\n", output_file );
+	if ( missing_references > 0 )
+		printf( "%d reference(s) missing, their rmse is null, run --write-references to create them\n", missing_references );
+	return EXIT_SUCCESS;
+}
+
+namespace
+{
+	const double kConvergenceFirstPoint = 0.25; // seconds
+	const double kConvergenceBudget = 64.0; // seconds per configuration
+	const double kConvergenceTarget = 0.01; // relMSE
+	const int kConvergenceReferencePasses = 1024;
+
+	struct ConvergenceConfig
+	{
+		const char * name;
+		bool path_deep;
+		int path_samples;
+		int ss;
+		bool roulette;
+	};
+
+	const ConvergenceConfig kConvergenceConfigs[] = {
+		// shallow paths draw path_samples + 1 samples at the first bounce
+		{ "shallow_2spp", false, 1, 0, true },
+		{ "shallow_4spp", false, 3, 0, true },
+		{ "deep_1spp", true, 1, 0, true },
+		{ "deep_1spp_no_roulette", true, 1, 0, false },
+		{ "shallow_18spp_ss1", false, 1, 1, true }, // 3x3 camera samples x 2
+	};
+
+	void SetupConvergence( Raytracer & raytracer, const ConvergenceConfig & convergence_config )
+	{
+		SetupPath( raytracer );
+		raytracer.path_deep_ = convergence_config.path_deep;
+		raytracer.PATH_SAMPLES = convergence_config.path_samples;
+		raytracer.ss_ = convergence_config.ss;
+		raytracer.roulette_ = convergence_config.roulette;
+	}
+
+	// high-spp reference with the pixel filter of the given supersampling, rendered once with a different
+	// seed than the measured runs, a reference of another filter would leave an error floor
+	void ConvergenceReference( const BenchmarkScene & scene, const int ss, const char * config, std::vector<float> & reference )
+	{
+		char reference_file[256];
+		sprintf( reference_file, "%s%s_converged_ss%d.pfm", kReferenceDirectory, scene.name, ss );
+		int reference_width = 0, reference_height = 0;
+		if ( ReadPfm( reference_file, reference, reference_width, reference_height ) &&
+			reference_width == kWidth && reference_height == kHeight )
+			return;
+
+		// about the same number of samples per pixel for every filter
+		const int passes = max( 1, kConvergenceReferencePasses / ( ( 2 * ss + 1 ) * ( 2 * ss + 1 ) ) );
+		printf( "Rendering reference %s (%d passes)\n", reference_file, passes );
+		Vector3 light = scene.light;
+		Vector3 light_power = scene.light_power;
+		Vector3 background( 1, 1, 1 );
+		Raytracer raytracer( kWidth, kHeight, deg2rad( scene.fov_y ), scene.view_from, scene.view_at,
+			&light, &light_power, &background, config, true );
+		raytracer.seed_ = kSeed + 1;
+		raytracer.heatmaps_ = false;
+		raytracer.cubeMap_->returnTexture = true;
+		SetupConvergence( raytracer, ConvergenceConfig{ "reference", true, 4, ss, true } );
+		raytracer.LoadScene( scene.file_name );
+		raytracer.RenderHeadless( passes );
+
+		if ( !WritePfm( reference_file, raytracer.image(), kWidth, kHeight ) )
+			printf( "Unable to write %s\n", reference_file );
+		if ( !ReadPfm( reference_file, reference, reference_width, reference_height ) )
+		{
+			// keep going with the in-memory reference
+			reference.resize( kWidth * kHeight * 3 );
+			for ( int y = 0; y < kHeight; ++y )
+				for ( int x = 0; x < kWidth; ++x )
+					for ( int c = 0; c < 3; ++c )
+						reference[( ( kHeight - 1 - y ) * kWidth + x ) * 3 + c] = raytracer.image()[( y * kWidth + x ) * 4 + c];
+		}
+	}
+}
+
+int convergence( const char * output_file, const char * config )
+{
+	const BenchmarkScene & scene = kScenes[0]; // cornell box, the path tracing scene
+	if ( !FileExists( scene.file_name ) )
+	{
+		printf( "%s is missing\n", scene.file_name );
+		return EXIT_FAILURE;
+	}
+
+	Vector3 light = scene.light;
+	Vector3 light_power = scene.light_power;
+	Vector3 background( 1, 1, 1 );
+
+	FILE * json = fopen( output_file, "w" );
+	if ( json == nullptr )
+	{
+		printf( "Unable to open %s\n", output_file );
+		return EXIT_FAILURE;
+	}
+	fprintf( json, "{\n\"scene\":\"%s\",\"width\":%d,\"height\":%d,\"seed\":%u,\"target_rel_mse\":%g,\n\"configs\":[\n",
+		scene.name, kWidth, kHeight, kSeed, kConvergenceTarget );
+
+	std::map<int, std::vector<float>> references; // per supersampling
+
+	for ( size_t i = 0; i < sizeof( kConvergenceConfigs ) / sizeof( kConvergenceConfigs[0] ); ++i )
+	{
+		const ConvergenceConfig & convergence_config = kConvergenceConfigs[i];
+		std::vector<float> & reference = references[convergence_config.ss];
+		if ( reference.empty() )
+			ConvergenceReference( scene, convergence_config.ss, config, reference );
+
+		Raytracer raytracer( kWidth, kHeight, deg2rad( scene.fov_y ), scene.view_from, scene.view_at,
+			&light, &light_power, &background, config, true );
+		raytracer.seed_ = kSeed;
+		raytracer.heatmaps_ = false;
+		raytracer.cubeMap_->returnTexture = true;
+		SetupConvergence( raytracer, convergence_config );
+		raytracer.LoadScene( scene.file_name );
+
+		const int spp_per_pass = raytracer.samples_per_pixel();
+		fprintf( json, "%s{\"name\":\"%s\",\"path_deep\":%s,\"path_samples\":%d,\"ss\":%d,\"roulette\":%s,\"points\":[",
+			i == 0 ? "" : ",\n", convergence_config.name, convergence_config.path_deep ? "true" : "false",
+			convergence_config.path_samples, convergence_config.ss, convergence_config.roulette ? "true" : "false" );
+
+		// render time only, the error evaluation is not counted
+		double rendered = 0, next_point = kConvergenceFirstPoint, time_to_target = -1;
+		int passes = 0;
+		bool first_point = true;
+		while ( rendered < kConvergenceBudget )
+		{
+			const auto start = std::chrono::steady_clock::now();
+			raytracer.RenderHeadless( 1 );
+			rendered += std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+			passes++;
+
+			if ( rendered < next_point && rendered < kConvergenceBudget )
+				continue;
+			while ( next_point <= rendered )
+				next_point *= sqrt( 2.0 ); // two points per doubling of time
+
+			double mse = 0, rel_mse = 0;
+			Mse( raytracer.image(), reference, kWidth, kHeight, mse, rel_mse );
+			if ( time_to_target < 0 && rel_mse <= kConvergenceTarget )
+				time_to_target = rendered;
+
+			fprintf( json, "%s{\"seconds\":%.4f,\"spp\":%d,\"mse\":%.8g,\"rel_mse\":%.8g}",
+				first_point ? "" : ",", rendered, passes * spp_per_pass, mse, rel_mse );
+			first_point = false;
+			printf( "%s: %.2f s, %d spp, mse %.6g, relMSE %.6g\n", convergence_config.name, rendered, passes * spp_per_pass, mse, rel_mse );
+		}
+
+		if ( time_to_target >= 0 )
+			fprintf( json, "],\"time_to_target\":%.4f}", time_to_target );
+		else
+			fprintf( json, "],\"time_to_target\":null}" );
+	}
+
+	fprintf( json, "\n]\n}\n" );
+	fclose( json );
+
+	printf( "Convergence results written to %s\n", output_file );
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,27 @@
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+/*! \fn benchmark
+\brief Renders the bundled scenes in fixed configurations without a window and writes the results as JSON.
+
+Every run uses a fixed seed, so the image of a configuration is reproducible and
+is compared against a local reference (data/benchmark/<scene>_<config>.pfm).
+References are not committed, they are written from the current render with
+write_references; a missing one is reported and its rmse is null. The branch roulette
+configurations are compared with the reference of the full Whitted tree, their
+error has to keep falling with the number of passes. Scenes without geometry
+are reported as skipped.
+*/
+int benchmark( const char * output_file = "benchmark.json", const char * config = "threads=0,verbose=0", const bool write_references = false );
+
+/*! \fn convergence
+\brief Renders a scene progressively per integrator configuration and writes error-versus-time curves as JSON.
+
+At log-spaced time points the accumulated image is compared with a high-spp
+reference (MSE and relMSE); the time to reach the target relMSE is reported per
+configuration. Every supersampling setting has its own reference, so the pixel
+filter matches; references are rendered once and stored next to the benchmark ones.
+*/
+int convergence( const char * output_file = "convergence.json", const char * config = "threads=0,verbose=0" );
+
+#endif
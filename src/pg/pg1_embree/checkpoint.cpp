@@ -0,0 +1,126 @@
+#include "stdafx.h"
+#include "checkpoint.h"
+
+namespace
+{
+	const char kMagic[4] = { 'P', 'G', '1', 'C' };
+	const int kVersion = 1;
+}
+
+unsigned long long HashBytes( const void * data, const size_t size, unsigned long long hash )
+{
+	const unsigned char * bytes = static_cast<const unsigned char *>( data );
+	for ( size_t i = 0; i < size; ++i )
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+bool Checkpoint::Write( const char * file_name ) const
+{
+	// write next to the target and swap afterwards, an interrupted write keeps the old checkpoint
+	const std::string temp = std::string( file_name ) + ".tmp";
+	FILE * file = fopen( temp.c_str(), "wb" );
+	if ( file == nullptr )
+		return false;
+
+	bool ok = fwrite( kMagic, sizeof( kMagic ), 1, file ) == 1;
+	ok = ok && fwrite( &kVersion, sizeof( kVersion ), 1, file ) == 1;
+	ok = ok && fwrite( &width, sizeof( width ), 1, file ) == 1;
+	ok = ok && fwrite( &height, sizeof( height ), 1, file ) == 1;
+	ok = ok && fwrite( &settings, sizeof( settings ), 1, file ) == 1;
+	ok = ok && fwrite( &samples, sizeof( samples ), 1, file ) == 1;
+	ok = ok && fwrite( &seed, sizeof( seed ), 1, file ) == 1;
+	ok = ok && fwrite( &frame, sizeof( frame ), 1, file ) == 1;
+	ok = ok && fwrite( film.data(), sizeof( float ), film.size(), file ) == film.size();
+	ok = fclose( file ) == 0 && ok;
+
+	if ( !ok )
+	{
+		remove( temp.c_str() );
+		return false;
+	}
+
+	remove( file_name );
+	return rename( temp.c_str(), file_name ) == 0;
+}
+
+bool Checkpoint::Read( const char * file_name )
+{
+	FILE * file = fopen( file_name, "rb" );
+	if ( file == nullptr )
+		return false;
+
+	char magic[4];
+	int version = 0;
+	bool ok = fread( magic, sizeof( magic ), 1, file ) == 1 && memcmp( magic, kMagic, sizeof( kMagic ) ) == 0;
+	ok = ok && fread( &version, sizeof( version ), 1, file ) == 1 && version == kVersion;
+	ok = ok && fread( &width, sizeof( width ), 1, file ) == 1;
+	ok = ok && fread( &height, sizeof( height ), 1, file ) == 1;
+	ok = ok && width > 0 && height > 0;
+	ok = ok && fread( &settings, sizeof( settings ), 1, file ) == 1;
+	ok = ok && fread( &samples, sizeof( samples ), 1, file ) == 1;
+	ok = ok && fread( &seed, sizeof( seed ), 1, file ) == 1;
+	ok = ok && fread( &frame, sizeof( frame ), 1, file ) == 1;
+
+	if ( ok )
+	{
+		film.resize( static_cast<size_t>( width ) * height * 4 );
+		ok = fread( film.data(), sizeof( float ), film.size(), file ) == film.size();
+	}
+
+	fclose( file );
+	return ok;
+}
+
+CheckpointWriter::CheckpointWriter()
+{
+	thread_ = std::thread( &CheckpointWriter::Run, this );
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock( lock_ );
+		finish_ = true;
+	}
+	wake_.notify_one();
+	thread_.join();
+}
+
+void CheckpointWriter::Submit( Checkpoint checkpoint, const std::string & file_name )
+{
+	{
+		std::lock_guard<std::mutex> lock( lock_ );
+		pending_ = std::move( checkpoint );
+		file_name_ = file_name;
+		has_pending_ = true;
+	}
+	wake_.notify_one();
+}
+
+void CheckpointWriter::Run()
+{
+	for ( ;; )
+	{
+		Checkpoint checkpoint;
+		std::string file_name;
+		{
+			std::unique_lock<std::mutex> lock( lock_ );
+			wake_.wait( lock, [this] { return finish_ || has_pending_; } );
+			// a pending checkpoint is still written on shutdown
+			if ( !has_pending_ )
+				return;
+			checkpoint = std::move( pending_ );
+			file_name = file_name_;
+			has_pending_ = false;
+		}
+
+		if ( checkpoint.Write( file_name.c_str() ) )
+			printf( "checkpoint %s, %d samples\n", file_name.c_str(), static_cast<int>( checkpoint.samples ) );
+		else
+			printf( "Unable to write checkpoint %s\n", file_name.c_str() );
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <condition_variable>
+
+/*! \struct Checkpoint
+\brief State needed to continue a progressive render.
+
+Every pixel of the film holds the mean of the same number of samples, so a
+single sample count describes the whole film. The per pixel generators are
+seeded from seed and frame, storing them restores the exact sample sequence.
+*/
+struct Checkpoint
+{
+	int width{ 0 };
+	int height{ 0 };
+	unsigned long long settings{ 0 }; // hash of everything that changes the image
+	float samples{ 0 }; // SimpleGuiDX11::n
+	unsigned int seed{ 0 };
+	int frame{ 0 };
+	std::vector<float> film; // width * height * 4 linear RGBA means
+
+	bool Write( const char * file_name ) const;
+	bool Read( const char * file_name );
+};
+
+/* FNV-1a, used to build the settings hash of checkpoints */
+unsigned long long HashBytes( const void * data, const size_t size, unsigned long long hash = 14695981039346656037ULL );
+
+/*! \class CheckpointWriter
+\brief Writes checkpoints on its own thread.
+
+Only the newest checkpoint matters, a pending one that was not written yet is
+replaced by the next Submit.
+*/
+class CheckpointWriter
+{
+public:
+	CheckpointWriter();
+	~CheckpointWriter();
+
+	void Submit( Checkpoint checkpoint, const std::string & file_name );
+
+private:
+	void Run();
+
+	Checkpoint pending_;
+	std::string file_name_;
+	bool has_pending_{ false };
+	bool finish_{ false };
+	std::mutex lock_;
+	std::condition_variable wake_;
+	std::thread thread_;
+};
@@ -0,0 +1,541 @@
+#include "stdafx.h"
+#include "distributed.h"
+#include "raytracer.h"
+#include "imagewriter.h"
+#include "mymath.h"
+#include <algorithm>
+
+#ifdef _WIN32
+// winsock2.h and ws2tcpip.h are included by stdafx.h ahead of windows.h
+typedef SOCKET Socket;
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+typedef int Socket;
+const Socket INVALID_SOCKET = -1;
+#define closesocket close
+#endif
+
+namespace
+{
+	const int kTileRows = 16;
+
+	enum MessageType
+	{
+		kMessageHello, // worker -> coordinator, Hello
+		kMessageLease, // coordinator -> worker, Lease
+		kMessageResult, // worker -> coordinator, Lease followed by the RGBA floats of the tile
+		kMessageFinish, // coordinator -> worker, no payload
+	};
+
+	struct MessageHeader
+	{
+		int type;
+		int size; // payload bytes
+	};
+
+	struct Hello
+	{
+		unsigned long long settings;
+		int width;
+		int height;
+	};
+
+	struct Lease
+	{
+		int id;
+		int pass;
+		int y0;
+		int y1;
+		unsigned int seed; // base seed of the frame, chosen by the coordinator
+	};
+
+	// both ends run the same build on the same kind of machine, so structs go over the wire as they are
+	bool SendAll( Socket socket, const void * data, size_t size )
+	{
+		const char * bytes = static_cast<const char *>( data );
+		while ( size > 0 )
+		{
+			const int sent = send( socket, bytes, static_cast<int>( size ), 0 );
+			if ( sent <= 0 )
+				return false;
+			bytes += sent;
+			size -= sent;
+		}
+		return true;
+	}
+
+	bool ReceiveAll( Socket socket, void * data, size_t size )
+	{
+		char * bytes = static_cast<char *>( data );
+		while ( size > 0 )
+		{
+			const int received = recv( socket, bytes, static_cast<int>( size ), 0 );
+			if ( received <= 0 )
+				return false;
+			bytes += received;
+			size -= received;
+		}
+		return true;
+	}
+
+	bool SendPacket( Socket socket, const int type, const void * payload, const int size, const void * extra = nullptr, const int extra_size = 0 )
+	{
+		const MessageHeader header{ type, size + extra_size };
+		return SendAll( socket, &header, sizeof( header ) ) &&
+			SendAll( socket, payload, size ) &&
+			SendAll( socket, extra, extra_size );
+	}
+
+	bool StartSockets()
+	{
+#ifdef _WIN32
+		WSADATA data;
+		return WSAStartup( MAKEWORD( 2, 2 ), &data ) == 0;
+#else
+		return true;
+#endif
+	}
+
+	void StopSockets()
+	{
+#ifdef _WIN32
+		WSACleanup();
+#endif
+	}
+
+	/*! \class TileCoordinator
+	\brief Lease bookkeeping and film merging of the coordinator.
+	*/
+	class TileCoordinator
+	{
+	public:
+		TileCoordinator( const int passes, const float lease_timeout ) : passes_( passes ), lease_timeout_( lease_timeout )
+		{
+		}
+
+		int Run( Socket listener, const char * output_file );
+
+	private:
+		struct Client
+		{
+			Socket socket;
+			bool ready; // hello received and accepted
+			int lease; // index into leases_ or -1
+			std::vector<char> buffer; // bytes of a partially received message
+		};
+
+		struct TileLease
+		{
+			Lease lease;
+			bool done;
+			int client; // latest worker holding it, -1 when nobody does
+			std::chrono::steady_clock::time_point granted; // first grant since nobody held it
+			int reissues; // copies handed to other workers while the first holder is still busy
+		};
+
+		void Start( const Hello & hello );
+		bool Receive( Client & client, const int index );
+		bool Handle( Client & client, const int index, const MessageHeader & header, const char * payload );
+		void Assign( Client & client, const int index );
+		void Revoke( const int lease, const int index );
+		void ExpireLeases();
+		bool Pending( const int lease ) const;
+
+		int passes_;
+		float lease_timeout_;
+		bool started_{ false };
+		Hello frame_{};
+		unsigned int seed_{ 0 }; // every worker renders with it, so a lease renders the same samples anywhere
+		std::vector<Client> clients_;
+		std::vector<TileLease> leases_;
+		std::deque<int> pending_;
+		int remaining_{ 0 };
+		std::vector<float> sum_; // RGBA sums over merged passes
+		std::vector<int> samples_; // merged passes of every row
+	};
+
+	void TileCoordinator::Start( const Hello & hello )
+	{
+		frame_ = hello;
+		seed_ = std::random_device{}();
+		started_ = true;
+
+		for ( int pass = 0; pass < passes_; ++pass )
+			for ( int y = 0; y < hello.height; y += kTileRows )
+			{
+				const int id = static_cast<int>( leases_.size() );
+				leases_.push_back( TileLease{ Lease{ id, pass, y, min( y + kTileRows, hello.height ), seed_ }, false, -1, {}, 0 } );
+				pending_.push_back( id );
+			}
+
+		remaining_ = static_cast<int>( leases_.size() );
+		sum_.assign( static_cast<size_t>( hello.width ) * hello.height * 4, 0.0f );
+		samples_.assign( hello.height, 0 );
+		printf( "coordinator: %d x %d, %d passes, %d leases, seed %u\n", hello.width, hello.height, passes_, remaining_, seed_ );
+	}
+
+	void TileCoordinator::Assign( Client & client, const int index )
+	{
+		if ( client.lease >= 0 || pending_.empty() )
+			return;
+
+		const int id = pending_.front();
+		pending_.pop_front();
+
+		TileLease & tile = leases_[id];
+		// a copy of a late lease keeps the time of the first grant
+		if ( tile.client < 0 )
+			tile.granted = std::chrono::steady_clock::now();
+		tile.client = index;
+		client.lease = id;
+
+		if ( !SendPacket( client.socket, kMessageLease, &tile.lease, sizeof( tile.lease ) ) )
+			Revoke( id, index );
+	}
+
+	bool TileCoordinator::Pending( const int lease ) const
+	{
+		return std::find( pending_.begin(), pending_.end(), lease ) != pending_.end();
+	}
+
+	// the worker no longer holds the lease, it is pending again unless another worker still renders it
+	void TileCoordinator::Revoke( const int lease, const int index )
+	{
+		if ( clients_[index].lease == lease )
+			clients_[index].lease = -1;
+
+		TileLease & tile = leases_[lease];
+		if ( tile.done )
+			return;
+
+		for ( int i = 0; i < static_cast<int>( clients_.size() ); ++i )
+			if ( clients_[i].socket != INVALID_SOCKET && clients_[i].lease == lease )
+			{
+				tile.client = i;
+				return;
+			}
+
+		tile.client = -1;
+		tile.reissues = 0;
+		if ( !Pending( lease ) )
+			pending_.push_front( lease );
+	}
+
+	// a late lease stays with its worker and a copy is queued for another one, at most once per timeout
+	// since the first grant, so a slow tile is not handed out over and over
+	void TileCoordinator::ExpireLeases()
+	{
+		const auto now = std::chrono::steady_clock::now();
+		const auto timeout = std::chrono::milliseconds( static_cast<int>( lease_timeout_ * 1000 ) );
+		for ( TileLease & tile : leases_ )
+			if ( !tile.done && tile.client >= 0 && now > tile.granted + timeout * ( tile.reissues + 1 ) && !Pending( tile.lease.id ) )
+			{
+				printf( "coordinator: lease %d (pass %d, rows %d-%d) timed out, issued again\n", tile.lease.id, tile.lease.pass, tile.lease.y0, tile.lease.y1 );
+				tile.reissues++;
+				pending_.push_front( tile.lease.id );
+			}
+	}
+
+	bool TileCoordinator::Handle( Client & client, const int index, const MessageHeader & header, const char * payload )
+	{
+		if ( header.type == kMessageHello && header.size == sizeof( Hello ) )
+		{
+			Hello hello;
+			memcpy( &hello, payload, sizeof( hello ) );
+
+			if ( !started_ )
+				Start( hello );
+			else if ( hello.settings != frame_.settings || hello.width != frame_.width || hello.height != frame_.height )
+			{
+				printf( "coordinator: worker %d has different settings, refused\n", index );
+				return false;
+			}
+
+			client.ready = true;
+			return true;
+		}
+
+		if ( header.type == kMessageResult && client.ready && header.size >= static_cast<int>( sizeof( Lease ) ) )
+		{
+			Lease lease;
+			memcpy( &lease, payload, sizeof( lease ) );
+			if ( lease.id < 0 || lease.id >= static_cast<int>( leases_.size() ) )
+				return false;
+
+			TileLease & tile = leases_[lease.id];
+			// samples of another sequence must not be merged
+			if ( lease.seed != seed_ || lease.pass != tile.lease.pass || lease.y0 != tile.lease.y0 || lease.y1 != tile.lease.y1 )
+			{
+				printf( "coordinator: worker %d returned lease %d with a different seed or rows, refused\n", index, lease.id );
+				return false;
+			}
+
+			const size_t floats = static_cast<size_t>( tile.lease.y1 - tile.lease.y0 ) * frame_.width * 4;
+			if ( header.size != static_cast<int>( sizeof( Lease ) + floats * sizeof( float ) ) )
+				return false;
+
+			if ( client.lease == lease.id )
+				client.lease = -1;
+
+			// a revoked lease that was rendered by someone else in the meantime
+			if ( tile.done )
+				return true;
+
+			const float * rgba = reinterpret_cast<const float *>( payload + sizeof( Lease ) );
+			float * sum = &sum_[static_cast<size_t>( tile.lease.y0 ) * frame_.width * 4];
+			for ( size_t i = 0; i < floats; ++i )
+				sum[i] += rgba[i];
+			for ( int y = tile.lease.y0; y < tile.lease.y1; ++y )
+				samples_[y]++;
+
+			// a late lease may come back from its first worker while a copy is pending or rendered elsewhere
+			const auto queued = std::find( pending_.begin(), pending_.end(), lease.id );
+			if ( queued != pending_.end() )
+				pending_.erase( queued );
+			for ( Client & holder : clients_ )
+				if ( holder.lease == lease.id )
+					holder.lease = -1;
+
+			tile.done = true;
+			tile.client = -1;
+			remaining_--;
+			return true;
+		}
+
+		return false;
+	}
+
+	bool TileCoordinator::Receive( Client & client, const int index )
+	{
+		char bytes[64 * 1024];
+		const int received = recv( client.socket, bytes, sizeof( bytes ), 0 );
+		if ( received <= 0 )
+			return false;
+
+		client.buffer.insert( client.buffer.end(), bytes, bytes + received );
+
+		// handle all complete messages
+		size_t offset = 0;
+		while ( client.buffer.size() - offset >= sizeof( MessageHeader ) )
+		{
+			MessageHeader header;
+			memcpy( &header, &client.buffer[offset], sizeof( header ) );
+			if ( header.size < 0 )
+				return false;
+			if ( client.buffer.size() - offset - sizeof( header ) < static_cast<size_t>( header.size ) )
+				break;
+
+			if ( !Handle( client, index, header, &client.buffer[offset + sizeof( header )] ) )
+				return false;
+			offset += sizeof( header ) + header.size;
+		}
+		client.buffer.erase( client.buffer.begin(), client.buffer.begin() + offset );
+		return true;
+	}
+
+	int TileCoordinator::Run( Socket listener, const char * output_file )
+	{
+		while ( !started_ || remaining_ > 0 )
+		{
+			fd_set sockets;
+			FD_ZERO( &sockets );
+			FD_SET( listener, &sockets );
+			Socket highest = listener;
+			for ( const Client & client : clients_ )
+				if ( client.socket != INVALID_SOCKET )
+				{
+					FD_SET( client.socket, &sockets );
+					highest = max( highest, client.socket );
+				}
+
+			// wake up regularly to check the lease deadlines
+			timeval timeout{ 0, 250 * 1000 };
+			if ( select( static_cast<int>( highest + 1 ), &sockets, nullptr, nullptr, &timeout ) < 0 )
+			{
+				printf( "coordinator: select failed\n" );
+				return EXIT_FAILURE;
+			}
+
+			if ( FD_ISSET( listener, &sockets ) )
+			{
+				const Socket socket = accept( listener, nullptr, nullptr );
+				if ( socket != INVALID_SOCKET )
+				{
+					clients_.push_back( Client{ socket, false, -1, {} } );
+					printf( "coordinator: worker %d connected\n", static_cast<int>( clients_.size() ) - 1 );
+				}
+			}
+
+			for ( int i = 0; i < static_cast<int>( clients_.size() ); ++i )
+			{
+				if ( clients_[i].socket == INVALID_SOCKET || !FD_ISSET( clients_[i].socket, &sockets ) )
+					continue;
+
+				if ( !Receive( clients_[i], i ) )
+				{
+					printf( "coordinator: worker %d disconnected\n", i );
+					closesocket( clients_[i].socket );
+					clients_[i].socket = INVALID_SOCKET;
+					if ( clients_[i].lease >= 0 )
+						Revoke( clients_[i].lease, i );
+				}
+			}
+
+			ExpireLeases();
+
+			for ( int i = 0; i < static_cast<int>( clients_.size() ); ++i )
+				if ( clients_[i].socket != INVALID_SOCKET && clients_[i].ready )
+					Assign( clients_[i], i );
+		}
+
+		for ( Client & client : clients_ )
+			if ( client.socket != INVALID_SOCKET )
+			{
+				SendPacket( client.socket, kMessageFinish, nullptr, 0 );
+				closesocket( client.socket );
+			}
+
+		// every row holds the same number of passes once all leases are done
+		ImageWriter::Job job;
+		job.rgba.resize( sum_.size() );
+		for ( int y = 0; y < frame_.height; ++y )
+			for ( int i = y * frame_.width * 4; i < ( y + 1 ) * frame_.width * 4; ++i )
+				job.rgba[i] = sum_[i] / max( samples_[y], 1 );
+		job.width = frame_.width;
+		job.height = frame_.height;
+		job.format = ImageWriter::format( output_file, job.file_name );
+		job.display = false;
+
+		ImageWriter writer;
+		writer.Submit( std::move( job ) );
+		writer.Flush();
+
+		printf( "coordinator: %d passes merged into %s\n", passes_, output_file );
+		return EXIT_SUCCESS;
+	}
+}
+
+int coordinator( const int port, const int passes, const char * output_file, const float lease_timeout )
+{
+	if ( !StartSockets() )
+		return EXIT_FAILURE;
+
+	FreeImage_Initialise();
+
+	Socket listener = socket( AF_INET, SOCK_STREAM, IPPROTO_TCP );
+	sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl( INADDR_ANY );
+	address.sin_port = htons( static_cast<unsigned short>( port ) );
+
+	if ( listener == INVALID_SOCKET ||
+		bind( listener, reinterpret_cast<sockaddr *>( &address ), sizeof( address ) ) != 0 ||
+		listen( listener, SOMAXCONN ) != 0 )
+	{
+		printf( "coordinator: unable to listen on port %d\n", port );
+		if ( listener != INVALID_SOCKET )
+			closesocket( listener );
+		FreeImage_DeInitialise();
+		StopSockets();
+		return EXIT_FAILURE;
+	}
+
+	printf( "coordinator: waiting for workers on port %d\n", port );
+	TileCoordinator tiles( passes, lease_timeout );
+	const int result = tiles.Run( listener, output_file );
+
+	closesocket( listener );
+	FreeImage_DeInitialise();
+	StopSockets();
+	return result;
+}
+
+int worker( const char * host, const int port, const std::string file_name, const char * config )
+{
+	// camera and integrator of tutorial_5 without supersampling, so rows take the coherent sample_row path
+	Vector3 light{ 157, -157, 105 };
+	Vector3 light_power{ 0, 0, 0 };
+	Vector3 background( 0, 0, 0 );
+	Raytracer raytracer( 320, 240, deg2rad( 40.0 ), Vector3( 40, -940, 250 ), Vector3( 0, 0, 250 ),
+		&light, &light_power, &background, config, true );
+
+	raytracer.RAY_MAX_BUMPS = 0;
+	raytracer.PATH_SAMPLES = 2;
+	raytracer.ss_ = 0;
+	raytracer.path_ = true;
+	raytracer.path_deep_ = false;
+	raytracer.heatmaps_ = false;
+	raytracer.cubeMap_->returnTexture = false;
+	raytracer.LoadScene( file_name );
+
+	if ( !StartSockets() )
+		return EXIT_FAILURE;
+
+	char service[16];
+	sprintf( service, "%d", port );
+	addrinfo hints{};
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	addrinfo * addresses = nullptr;
+
+	Socket socket = INVALID_SOCKET;
+	if ( getaddrinfo( host, service, &hints, &addresses ) == 0 )
+	{
+		socket = ::socket( addresses->ai_family, addresses->ai_socktype, addresses->ai_protocol );
+		if ( socket != INVALID_SOCKET && connect( socket, addresses->ai_addr, static_cast<int>( addresses->ai_addrlen ) ) != 0 )
+		{
+			closesocket( socket );
+			socket = INVALID_SOCKET;
+		}
+		freeaddrinfo( addresses );
+	}
+
+	if ( socket == INVALID_SOCKET )
+	{
+		printf( "worker: unable to connect to %s:%d\n", host, port );
+		StopSockets();
+		return EXIT_FAILURE;
+	}
+
+	const Hello hello{ raytracer.settings_hash(), raytracer.width(), raytracer.height() };
+	bool connected = SendPacket( socket, kMessageHello, &hello, sizeof( hello ) );
+
+	std::vector<Color4f> tile( kTileRows * raytracer.width() );
+	int rendered = 0;
+
+	while ( connected )
+	{
+		MessageHeader header;
+		if ( !ReceiveAll( socket, &header, sizeof( header ) ) )
+			break;
+
+		if ( header.type == kMessageFinish )
+			break;
+
+		Lease lease;
+		if ( header.type != kMessageLease || header.size != sizeof( lease ) || !ReceiveAll( socket, &lease, sizeof( lease ) ) )
+			break;
+
+		const int rows = lease.y1 - lease.y0;
+		if ( rows <= 0 || rows > kTileRows )
+			break;
+
+		// pixels are seeded by (seed, x, y, pass), a lease renders the same samples on any worker
+		raytracer.ResetSequence( lease.seed );
+		raytracer.RenderRows( lease.pass, lease.y0, lease.y1, tile.data() );
+		connected = SendPacket( socket, kMessageResult, &lease, sizeof( lease ), tile.data(), rows * raytracer.width() * sizeof( Color4f ) );
+		rendered++;
+	}
+
+	raytracer.FinishRows();
+	printf( "worker: %d tiles rendered\n", rendered );
+	closesocket( socket );
+	StopSockets();
+	return EXIT_SUCCESS;
+}
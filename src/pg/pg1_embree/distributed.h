@@ -0,0 +1,26 @@
+#ifndef DISTRIBUTED_H_
+#define DISTRIBUTED_H_
+
+/*! \fn coordinator
+\brief Splits sample passes into tile leases, hands them to worker processes and merges the results.
+
+Workers connect over TCP and announce their settings hash and image size, the
+first one defines the frame, workers with other settings are refused. A tile
+is a band of full rows of one pass. The coordinator picks the base seed and
+sends it with every lease, the pixels are seeded by (seed, x, y, pass) so any
+worker renders the same samples and results of another seed are refused. A
+lease of a disconnected worker is handed out again. A lease not returned within
+lease_timeout seconds of its first grant stays with its worker and a copy goes
+to another one, once per timeout, and the later of the two results is dropped. The merged film is saved to output_file
+(.png, .exr or .pfm) after all passes are done.
+*/
+int coordinator( const int port, const int passes, const char * output_file = "distributed.png", const float lease_timeout = 30.0f );
+
+/*! \fn worker
+\brief Loads the scene headless, connects to a coordinator and renders leased tiles until it is told to finish.
+
+The tutorial_5 setup runs without supersampling, so the rows take the coherent path.
+*/
+int worker( const char * host, const int port, const std::string file_name, const char * config = "threads=0,verbose=0" );
+
+#endif
@@ -0,0 +1,71 @@
+#include "stdafx.h"
+#include "framebuffer.h"
+
+void FrameBuffer::Resize( const int width, const int height )
+{
+	width_ = width;
+	height_ = height;
+
+	for ( Buffer & buffer : buffers_ )
+	{
+		buffer.data.assign( static_cast<size_t>( width ) * height * 4, 0.0f );
+		buffer.versions.assign( height, 0 );
+	}
+	versions_.assign( height, 0 );
+
+	back_ = 0;
+	published_ = 0;
+	middle_.store( 1, std::memory_order_release );
+	front_ = 2;
+}
+
+float * FrameBuffer::row( const int y )
+{
+	Buffer & buffer = buffers_[back_];
+	buffer.versions[y] = ++versions_[y];
+	return &buffer.data[static_cast<size_t>( y ) * width_ * 4];
+}
+
+void FrameBuffer::Publish()
+{
+	published_ = back_;
+	back_ = middle_.exchange( back_ | kDirty, std::memory_order_acq_rel ) & kIndexMask;
+
+	// bring the new back buffer up to date, the published one is only read here
+	// and the consumer never writes, so both sides can touch it concurrently
+	const Buffer & latest = buffers_[published_];
+	Buffer & buffer = buffers_[back_];
+	const size_t row_size = static_cast<size_t>( width_ ) * 4;
+
+	for ( int y = 0; y < height_; ++y )
+	{
+		if ( buffer.versions[y] == versions_[y] )
+			continue;
+
+		memcpy( &buffer.data[y * row_size], &latest.data[y * row_size], row_size * sizeof( float ) );
+		buffer.versions[y] = versions_[y];
+	}
+}
+
+const float * FrameBuffer::Acquire( bool * fresh )
+{
+	const bool dirty = ( middle_.load( std::memory_order_acquire ) & kDirty ) != 0;
+
+	if ( dirty )
+		front_ = middle_.exchange( front_, std::memory_order_acq_rel ) & kIndexMask;
+
+	if ( fresh )
+		*fresh = dirty;
+
+	return buffers_[front_].data.data();
+}
+
+int FrameBuffer::width() const
+{
+	return width_;
+}
+
+int FrameBuffer::height() const
+{
+	return height_;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+/*! \class FrameBuffer
+\brief Triple-buffered display film shared by the renderer and the display.
+
+The producer writes rows into its back buffer and publishes it by swapping the
+back index with the middle one, the consumer swaps the middle index with its
+front one when a newer buffer is available. Neither side ever waits for the
+other. Publishing is allowed at any time during a pass, rows written since a
+buffer was last handed to the producer are copied into it from the latest
+published buffer, so every published buffer is a complete image.
+*/
+class FrameBuffer
+{
+public:
+	void Resize( const int width, const int height );
+
+	// producer side
+	float * row( const int y ); // RGBA floats of row y in the back buffer, marks the row as written
+	void Publish();
+
+	// consumer side, fresh is set when the returned buffer differs from the previous call
+	const float * Acquire( bool * fresh = nullptr );
+
+	int width() const;
+	int height() const;
+
+private:
+	static const int kIndexMask = 3;
+	static const int kDirty = 4;
+
+	struct Buffer
+	{
+		std::vector<float> data;
+		std::vector<unsigned int> versions; // version of every row stored in data
+	};
+
+	Buffer buffers_[3];
+	std::vector<unsigned int> versions_; // latest version of every row, producer only
+	int width_{ 0 };
+	int height_{ 0 };
+
+	int back_{ 0 }; // producer only
+	int published_{ 0 }; // last buffer published by the producer
+	std::atomic<int> middle_{ 1 };
+	int front_{ 2 }; // consumer only
+};
@@ -0,0 +1,173 @@
+#include "stdafx.h"
+#include "imagewriter.h"
+#include "SrgbTransform.h"
+#include <FreeImage.h>
+
+ImageWriter::ImageWriter()
+{
+	thread_ = std::thread(&ImageWriter::Run, this);
+}
+
+ImageWriter::~ImageWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		finish_ = true;
+	}
+	not_empty_.notify_all();
+	thread_.join();
+}
+
+void ImageWriter::Submit(Job job)
+{
+	{
+		std::unique_lock<std::mutex> lock(lock_);
+		not_full_.wait(lock, [this] { return queue_.size() < kMaxQueuedFrames; });
+		queue_.push_back(std::move(job));
+	}
+	not_empty_.notify_one();
+}
+
+void ImageWriter::Flush()
+{
+	std::unique_lock<std::mutex> lock(lock_);
+	not_full_.wait(lock, [this] { return queue_.empty() && !writing_; });
+}
+
+void ImageWriter::Run()
+{
+	for (;;)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(lock_);
+			not_empty_.wait(lock, [this] { return finish_ || !queue_.empty(); });
+			// pending frames are still written on shutdown
+			if (queue_.empty())
+				return;
+			job = std::move(queue_.front());
+			queue_.pop_front();
+			writing_ = true;
+		}
+		not_full_.notify_all();
+
+		if (!Write(job))
+			printf("Unable to save %s%s\n", job.file_name.c_str(), extension(job.format));
+
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			writing_ = false;
+		}
+		not_full_.notify_all();
+	}
+}
+
+const char* ImageWriter::extension(const ImageFormat format)
+{
+	static const char* extensions[kImageFormatCount] = { ".png", ".png", ".exr", ".pfm" };
+	return extensions[format];
+}
+
+ImageFormat ImageWriter::format(const std::string& file_name, std::string& prefix)
+{
+	const size_t dot = file_name.find_last_of('.');
+	prefix = file_name.substr(0, dot);
+	const std::string extension = dot == std::string::npos ? "" : file_name.substr(dot);
+
+	if (extension == ".exr")
+		return kImageExr;
+	if (extension == ".pfm")
+		return kImagePfm;
+	return kImagePng8;
+}
+
+const char* ImageWriter::name(const ImageFormat format)
+{
+	static const char* names[kImageFormatCount] = { "PNG 8-bit", "PNG 16-bit", "EXR", "PFM" };
+	return names[format];
+}
+
+static float Display(const float value, const bool display)
+{
+	const float v = display ? value : SrgbTransform::linearToSrgb(SrgbTransform::tonemap(value));
+	return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+}
+
+bool ImageWriter::Write(const Job& job)
+{
+	FIBITMAP* bitmap = nullptr;
+	FREE_IMAGE_FORMAT fif = FIF_PNG;
+	int flags = PNG_DEFAULT;
+
+	switch (job.format)
+	{
+	case kImagePng8:
+		bitmap = FreeImage_Allocate(job.width, job.height, 24);
+		break;
+	case kImagePng16:
+		bitmap = FreeImage_AllocateT(FIT_RGB16, job.width, job.height);
+		break;
+	case kImageExr:
+		bitmap = FreeImage_AllocateT(FIT_RGBAF, job.width, job.height);
+		fif = FIF_EXR;
+		flags = EXR_DEFAULT;
+		break;
+	case kImagePfm:
+		bitmap = FreeImage_AllocateT(FIT_RGBF, job.width, job.height);
+		fif = FIF_PFM;
+		flags = PFM_DEFAULT;
+		break;
+	default:
+		return false;
+	}
+
+	if (bitmap == nullptr)
+		return false;
+
+	// whole scanlines at once, FreeImage stores the bottom row first
+	for (int y = 0; y < job.height; ++y)
+	{
+		BYTE* line = FreeImage_GetScanLine(bitmap, job.height - 1 - y);
+		const float* src = &job.rgba[static_cast<size_t>(y) * job.width * 4];
+
+		switch (job.format)
+		{
+		case kImagePng8:
+			for (int x = 0; x < job.width; ++x, line += 3, src += 4)
+			{
+				line[FI_RGBA_RED] = static_cast<BYTE>(Display(src[0], job.display) * 255.f);
+				line[FI_RGBA_GREEN] = static_cast<BYTE>(Display(src[1], job.display) * 255.f);
+				line[FI_RGBA_BLUE] = static_cast<BYTE>(Display(src[2], job.display) * 255.f);
+			}
+			break;
+		case kImagePng16:
+			{
+				FIRGB16* pixels = reinterpret_cast<FIRGB16*>(line);
+				for (int x = 0; x < job.width; ++x, src += 4)
+				{
+					pixels[x].red = static_cast<WORD>(Display(src[0], job.display) * 65535.f);
+					pixels[x].green = static_cast<WORD>(Display(src[1], job.display) * 65535.f);
+					pixels[x].blue = static_cast<WORD>(Display(src[2], job.display) * 65535.f);
+				}
+			}
+			break;
+		case kImageExr:
+			memcpy(line, src, job.width * sizeof(FIRGBAF));
+			break;
+		case kImagePfm:
+			{
+				FIRGBF* pixels = reinterpret_cast<FIRGBF*>(line);
+				for (int x = 0; x < job.width; ++x, src += 4)
+					pixels[x] = FIRGBF{ src[0], src[1], src[2] };
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	const std::string path = job.file_name + extension(job.format);
+	const bool saved = FreeImage_Save(fif, bitmap, path.c_str(), flags) != 0;
+	FreeImage_Unload(bitmap);
+	return saved;
+}
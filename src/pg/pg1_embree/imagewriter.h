@@ -0,0 +1,62 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+
+/*! \enum ImageFormat
+\brief File formats written by ImageWriter.
+*/
+enum ImageFormat
+{
+	kImagePng8, // tonemapped sRGB, 8 bits per channel
+	kImagePng16, // tonemapped sRGB, 16 bits per channel
+	kImageExr, // linear float RGBA
+	kImagePfm, // linear float RGB
+	kImageFormatCount
+};
+
+/*! \class ImageWriter
+\brief Converts and saves finished frames on its own thread.
+
+The render thread only copies the float film into a job; conversion and file
+I/O happen on the writer thread. The queue is bounded, when it is full Submit
+waits so a slow disk throttles the renderer instead of exhausting memory.
+*/
+class ImageWriter
+{
+public:
+	struct Job
+	{
+		std::vector<float> rgba; // width * height * 4, top row first
+		int width;
+		int height;
+		std::string file_name; // without extension
+		ImageFormat format;
+		bool display; // values are already display referred, no tonemapping
+	};
+
+	ImageWriter();
+	~ImageWriter();
+
+	void Submit(Job job);
+	//! Waits until all submitted frames are written.
+	void Flush();
+
+	static const char* extension(const ImageFormat format);
+	// format chosen by the extension of file_name (.exr, .pfm, otherwise PNG), prefix is the name without it
+	static ImageFormat format(const std::string& file_name, std::string& prefix);
+	static const char* name(const ImageFormat format);
+
+private:
+	static const size_t kMaxQueuedFrames = 3;
+
+	void Run();
+	static bool Write(const Job& job);
+
+	std::deque<Job> queue_;
+	std::mutex lock_;
+	std::condition_variable not_empty_;
+	std::condition_variable not_full_;
+	bool writing_{ false };
+	bool finish_{ false };
+	std::thread thread_;
+};
@@ -81,18 +81,3 @@ Texture * Material::get_texture( const int slot ) const
 {
 	return textures_[slot];
 }
-
-bool Material::isMirror()
-{
-	return shader == 3;
-}
-
-bool Material::isReflective()
-{
-	return shader > 2;
-}
-
-bool Material::isTransparent()
-{
-	return shader == 4 || shader == 6 || shader == 7 || shader == 9;
-}
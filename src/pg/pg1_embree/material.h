@@ -132,9 +132,9 @@ public:
 	static const char kNormalMapSlot; /*!< slo slotu normlov textury. */
 	static const char kOpacityMapSlot; /*!< slo slotu transparentn textury. */
 
-	bool isMirror();
-	bool isReflective();
-	bool isTransparent();
+	bool isMirror() const { return shader == 3; }
+	bool isReflective() const { return shader > 2; }
+	bool isTransparent() const { return shader == 4 || shader == 6 || shader == 7 || shader == 9; }
 
 private:
 	Texture * textures_[NO_TEXTURES]; /*!< Pole ukazatel na textury. */
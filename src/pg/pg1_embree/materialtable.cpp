@@ -0,0 +1,84 @@
+#include "stdafx.h"
+#include "materialtable.h"
+
+void MaterialTable::Build(const std::vector<Material*>& materials)
+{
+	Clear();
+
+	for (auto material : materials)
+	{
+		Add(*material);
+		sources_.push_back(material);
+	}
+
+	// default material for surfaces without one
+	Add(Material());
+	sources_.push_back(nullptr);
+}
+
+void MaterialTable::AddGeometry(const unsigned int geom_id, const Material* material)
+{
+	int id = (int)sources_.size() - 1;
+	for (int i = 0; i < (int)sources_.size() - 1; ++i)
+		if (sources_[i] == material)
+		{
+			id = i;
+			break;
+		}
+
+	if (geometry.size() <= geom_id)
+		geometry.resize(geom_id + 1, id);
+	geometry[geom_id] = id;
+}
+
+void MaterialTable::Clear()
+{
+	flags.clear();
+	shader.clear();
+	ambient.clear();
+	diffuse.clear();
+	specular.clear();
+	emission.clear();
+	attenuation.clear();
+	shininess.clear();
+	ior.clear();
+	diffuse_map.clear();
+	textures.clear();
+	geometry.clear();
+	sources_.clear();
+}
+
+void MaterialTable::Add(const Material& material)
+{
+	unsigned char flag = 0;
+	if (material.isMirror())
+		flag |= kMaterialMirror;
+	if (material.isReflective())
+		flag |= kMaterialReflective;
+	if (material.isTransparent())
+		flag |= kMaterialTransparent;
+
+	flags.push_back(flag);
+	shader.push_back(material.shader);
+	ambient.push_back(material.ambient);
+	diffuse.push_back(material.diffuse);
+	specular.push_back(material.specular);
+	emission.push_back(material.emission);
+	attenuation.push_back(material.attenuation);
+	shininess.push_back(material.shininess);
+	ior.push_back(material.ior);
+	diffuse_map.push_back(TextureIndex(material.get_texture(Material::kDiffuseMapSlot)));
+}
+
+int MaterialTable::TextureIndex(Texture* texture)
+{
+	if (texture == nullptr)
+		return -1;
+
+	for (int i = 0; i < (int)textures.size(); ++i)
+		if (textures[i] == texture)
+			return i;
+
+	textures.push_back(texture);
+	return (int)textures.size() - 1;
+}
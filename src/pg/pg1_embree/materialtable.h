@@ -0,0 +1,53 @@
+#pragma once
+#include "vector3.h"
+#include "material.h"
+
+/* precomputed material flag bits */
+enum MaterialFlag : unsigned char
+{
+	kMaterialMirror = 1 << 0,
+	kMaterialReflective = 1 << 1,
+	kMaterialTransparent = 1 << 2
+};
+
+/*! \class MaterialTable
+\brief Scene materials stored as structure of arrays.
+
+Materials are addressed by index, the index of a hit is looked up directly
+by its geomID. The last entry is the default material used by surfaces
+without any material. Textures are referenced by index into \a textures.
+*/
+class MaterialTable
+{
+public:
+	void Build(const std::vector<Material*>& materials);
+	void AddGeometry(const unsigned int geom_id, const Material* material);
+	void Clear();
+
+	int size() const { return (int)flags.size(); }
+	int geometry_material(const unsigned int geom_id) const { return geometry[geom_id]; }
+
+	bool is_mirror(const int id) const { return (flags[id] & kMaterialMirror) != 0; }
+	bool is_reflective(const int id) const { return (flags[id] & kMaterialReflective) != 0; }
+	bool is_transparent(const int id) const { return (flags[id] & kMaterialTransparent) != 0; }
+
+	std::vector<unsigned char> flags;
+	std::vector<int> shader;
+	std::vector<Vector3> ambient;
+	std::vector<Vector3> diffuse;
+	std::vector<Vector3> specular;
+	std::vector<Vector3> emission;
+	std::vector<Vector3> attenuation;
+	std::vector<float> shininess;
+	std::vector<float> ior;
+	std::vector<int> diffuse_map; // index into textures, -1 without texture
+
+	std::vector<Texture*> textures;
+	std::vector<int> geometry; // material index for each geomID
+
+private:
+	void Add(const Material& material);
+	int TextureIndex(Texture* texture);
+
+	std::vector<const Material*> sources_; // materials in table order, for geometry lookup
+};
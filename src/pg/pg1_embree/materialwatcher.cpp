@@ -0,0 +1,137 @@
+#include "stdafx.h"
+#include "materialwatcher.h"
+#include "objloader.h"
+#include <sys/stat.h>
+
+MaterialWatcher::~MaterialWatcher()
+{
+	Stop();
+}
+
+void MaterialWatcher::Watch(const std::vector<std::string>& libraries, const std::vector<std::string>& textures,
+	const std::vector<std::string>& geometry_materials)
+{
+	Stop();
+
+	libraries_ = libraries;
+	geometry_materials_ = geometry_materials;
+	files_.clear();
+	for (const std::string& library : libraries_)
+		files_.push_back(WatchedFile{ library, Modified(library) });
+	for (const std::string& texture : textures)
+		files_.push_back(WatchedFile{ texture, Modified(texture) });
+
+	finish_ = false;
+	thread_ = std::thread(&MaterialWatcher::Run, this);
+}
+
+void MaterialWatcher::Stop()
+{
+	if (!thread_.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		finish_ = true;
+	}
+	wake_.notify_one();
+	thread_.join();
+
+	ReleaseMaterials(materials_);
+	ready_ = false;
+}
+
+bool MaterialWatcher::Take(std::vector<Material*>& materials, MaterialTable& table)
+{
+	std::lock_guard<std::mutex> lock(lock_);
+	if (!ready_)
+		return false;
+
+	materials.swap(materials_);
+	table = std::move(table_);
+	ready_ = false;
+	return true;
+}
+
+long long MaterialWatcher::Modified(const std::string& file_name)
+{
+	struct stat status;
+	return stat(file_name.c_str(), &status) == 0 ? static_cast<long long>(status.st_mtime) : -1;
+}
+
+bool MaterialWatcher::Changed()
+{
+	bool changed = false;
+	for (WatchedFile& file : files_)
+	{
+		const long long modified = Modified(file.file_name);
+		if (modified != file.modified)
+		{
+			file.modified = modified;
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+void MaterialWatcher::Run()
+{
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(lock_);
+			if (wake_.wait_for(lock, std::chrono::milliseconds(250), [this] { return finish_; }))
+				return;
+		}
+
+		if (Changed())
+		{
+			// editors often write a file in several steps, let them finish
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			Changed();
+			Reload();
+		}
+	}
+}
+
+void MaterialWatcher::Reload()
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	std::vector<Material*> materials;
+	for (const std::string& library : libraries_)
+	{
+		const size_t slash = library.find_last_of('/');
+		const std::string path = slash == std::string::npos ? "" : library.substr(0, slash + 1);
+		LoadMTL(library.c_str(), path.c_str(), materials);
+	}
+
+	MaterialTable table;
+	table.Build(materials);
+	for (unsigned int geom_id = 0; geom_id < geometry_materials_.size(); ++geom_id)
+	{
+		const Material* material = nullptr;
+		for (auto candidate : materials)
+			if (candidate->get_name() == geometry_materials_[geom_id])
+			{
+				material = candidate;
+				break;
+			}
+		table.AddGeometry(geom_id, material);
+	}
+
+	// textures named by the new materials are watched from now on
+	files_.resize(libraries_.size());
+	for (const Texture* texture : table.textures)
+		files_.push_back(WatchedFile{ texture->file_name(), Modified(texture->file_name()) });
+
+	printf("Materials reloaded: %d materials, %d textures in %.1f ms\n", static_cast<int>(materials.size()),
+		static_cast<int>(table.textures.size()), std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+	std::lock_guard<std::mutex> lock(lock_);
+	// an older reload the renderer did not take yet is replaced
+	ReleaseMaterials(materials_);
+	materials_.swap(materials);
+	table_ = std::move(table);
+	ready_ = true;
+}
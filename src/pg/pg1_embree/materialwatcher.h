@@ -0,0 +1,53 @@
+#pragma once
+#include "material.h"
+#include "materialtable.h"
+#include <condition_variable>
+
+/*! \class MaterialWatcher
+\brief Reloads the scene materials when their MTL or texture files change.
+
+A background thread polls the modification times of the watched files. After a
+change it parses the MTL libraries again, loads their textures and builds a
+new MaterialTable mapped to the same geometries by material name. The render
+thread picks the result up between passes with Take, the Embree scene is not
+touched.
+*/
+class MaterialWatcher
+{
+public:
+	~MaterialWatcher();
+
+	//! geometry_materials holds the material name of every geomID, empty for the default material
+	void Watch(const std::vector<std::string>& libraries, const std::vector<std::string>& textures,
+		const std::vector<std::string>& geometry_materials);
+	void Stop();
+
+	//! Moves reloaded materials and their table out, false if nothing changed since the last call.
+	bool Take(std::vector<Material*>& materials, MaterialTable& table);
+
+	//! Modification time in seconds, -1 if the file does not exist.
+	static long long Modified(const std::string& file_name);
+
+private:
+	struct WatchedFile
+	{
+		std::string file_name;
+		long long modified;
+	};
+
+	void Run();
+	bool Changed();
+	void Reload();
+
+	std::vector<std::string> libraries_;
+	std::vector<std::string> geometry_materials_;
+	std::vector<WatchedFile> files_;
+
+	std::mutex lock_;
+	std::condition_variable wake_;
+	bool finish_{ false };
+	bool ready_{ false };
+	std::vector<Material*> materials_;
+	MaterialTable table_;
+	std::thread thread_;
+};
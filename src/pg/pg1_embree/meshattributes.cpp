@@ -0,0 +1,333 @@
+#include "stdafx.h"
+#include "meshattributes.h"
+
+static short ToSnorm16(const float value)
+{
+	const float clamped = value < -1.0f ? -1.0f : (value > 1.0f ? 1.0f : value);
+	return static_cast<short>(floorf(clamped * 32767.0f + 0.5f));
+}
+
+static float FromSnorm16(const short value)
+{
+	const float v = value / 32767.0f;
+	return v < -1.0f ? -1.0f : v;
+}
+
+static float SignNotZero(const float value)
+{
+	return value >= 0.0f ? 1.0f : -1.0f;
+}
+
+// octahedral mapping of a unit vector to [-1, 1]^2
+static void EncodeNormal(const Vector3& normal, short packed[2])
+{
+	const float l1 = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+	if (l1 <= 0.0f)
+	{
+		packed[0] = packed[1] = 0;
+		return;
+	}
+
+	float x = normal.x / l1;
+	float y = normal.y / l1;
+	if (normal.z < 0.0f)
+	{
+		const float ox = x;
+		x = (1.0f - fabsf(y)) * SignNotZero(ox);
+		y = (1.0f - fabsf(ox)) * SignNotZero(y);
+	}
+
+	packed[0] = ToSnorm16(x);
+	packed[1] = ToSnorm16(y);
+}
+
+Normal3f MeshAttributes::DecodeNormal(const short packed[2])
+{
+	float x = FromSnorm16(packed[0]);
+	float y = FromSnorm16(packed[1]);
+	const float z = 1.0f - fabsf(x) - fabsf(y);
+	if (z < 0.0f)
+	{
+		const float ox = x;
+		x = (1.0f - fabsf(y)) * SignNotZero(ox);
+		y = (1.0f - fabsf(ox)) * SignNotZero(y);
+	}
+
+	const float length = sqrtf(x * x + y * y + z * z);
+	return Normal3f{ x / length, y / length, z / length };
+}
+
+unsigned short MeshAttributes::FloatToHalf(const float value)
+{
+	unsigned int f;
+	memcpy(&f, &value, sizeof(f));
+
+	const unsigned int sign = (f >> 16) & 0x8000;
+	const int exponent = static_cast<int>((f >> 23) & 0xff) - 127 + 15;
+	unsigned int mantissa = f & 0x7fffff;
+
+	if (exponent >= 31)
+		return static_cast<unsigned short>(sign | 0x7c00); // overflow, inf and nan
+
+	if (exponent <= 0)
+	{
+		// subnormal half
+		if (exponent < -10)
+			return static_cast<unsigned short>(sign);
+		mantissa |= 0x800000;
+		const int shift = 14 - exponent;
+		unsigned int half = mantissa >> shift;
+		if ((mantissa >> (shift - 1)) & 1)
+			++half;
+		return static_cast<unsigned short>(sign | half);
+	}
+
+	unsigned int half = sign | (exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000)
+		++half; // rounding may carry into the exponent, which is still correct
+	return static_cast<unsigned short>(half);
+}
+
+float MeshAttributes::HalfToFloat(const unsigned short value)
+{
+	const unsigned int sign = (value & 0x8000) << 16;
+	const unsigned int exponent = (value >> 10) & 0x1f;
+	const unsigned int mantissa = value & 0x3ff;
+
+	if (exponent == 0)
+	{
+		const float subnormal = ldexpf(static_cast<float>(mantissa), -24);
+		return sign ? -subnormal : subnormal;
+	}
+
+	const unsigned int f = exponent == 31
+		? sign | 0x7f800000 | (mantissa << 13)
+		: sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+
+	float result;
+	memcpy(&result, &f, sizeof(result));
+	return result;
+}
+
+void MeshAttributes::Add(const unsigned int geom_id, Surface& surface)
+{
+	if (geometries_.size() <= geom_id)
+		geometries_.resize(geom_id + 1);
+
+	Geometry& geometry = geometries_[geom_id];
+	geometry.surface = &surface;
+	Encode(geometry);
+}
+
+void MeshAttributes::Encode(Geometry& geometry) const
+{
+	Surface& surface = *geometry.surface;
+	const size_t corners = 3 * static_cast<size_t>(surface.no_triangles());
+
+	// release the arrays of the other mode
+	std::vector<Normal3f>().swap(geometry.normals);
+	std::vector<Coord2f>().swap(geometry.tex_coords);
+	std::vector<PackedNormal>().swap(geometry.packed_normals);
+	std::vector<PackedCoord>().swap(geometry.packed_tex_coords);
+
+	if (mode_ == kAttributesFull)
+	{
+		geometry.normals.resize(corners);
+		geometry.tex_coords.resize(corners);
+	}
+	else
+	{
+		geometry.packed_normals.resize(corners);
+		geometry.packed_tex_coords.resize(corners);
+	}
+
+	for (int i = 0, k = 0; i < surface.no_triangles(); ++i)
+	{
+		Triangle& triangle = surface.get_triangle(i);
+
+		for (int j = 0; j < 3; ++j, ++k)
+		{
+			const Vertex& vertex = triangle.vertex(j);
+
+			if (mode_ == kAttributesFull)
+			{
+				geometry.normals[k] = Normal3f{ vertex.normal.x, vertex.normal.y, vertex.normal.z };
+				geometry.tex_coords[k] = vertex.texture_coords[0];
+			}
+			else
+			{
+				short packed[2];
+				EncodeNormal(vertex.normal, packed);
+				geometry.packed_normals[k] = PackedNormal{ packed[0], packed[1] };
+				// half instead of UNORM, texture coordinates may be outside <0, 1> (wrapping)
+				geometry.packed_tex_coords[k] = PackedCoord{
+					FloatToHalf(vertex.texture_coords[0].u), FloatToHalf(vertex.texture_coords[0].v) };
+			}
+		}
+	}
+}
+
+void MeshAttributes::Clear()
+{
+	geometries_.clear();
+}
+
+void MeshAttributes::SetMode(const AttributeMode mode)
+{
+	if (mode == mode_)
+		return;
+
+	mode_ = mode;
+	for (auto& geometry : geometries_)
+		if (geometry.surface)
+			Encode(geometry);
+}
+
+size_t MeshAttributes::memory() const
+{
+	size_t bytes = 0;
+	for (const auto& geometry : geometries_)
+		bytes += geometry.normals.capacity() * sizeof(Normal3f) +
+			geometry.tex_coords.capacity() * sizeof(Coord2f) +
+			geometry.packed_normals.capacity() * sizeof(PackedNormal) +
+			geometry.packed_tex_coords.capacity() * sizeof(PackedCoord);
+	return bytes;
+}
+
+size_t MeshAttributes::memory(const AttributeMode mode) const
+{
+	const size_t corner = mode == kAttributesFull
+		? sizeof(Normal3f) + sizeof(Coord2f)
+		: sizeof(PackedNormal) + sizeof(PackedCoord);
+
+	size_t bytes = 0;
+	for (const auto& geometry : geometries_)
+		if (geometry.surface)
+			bytes += 3 * static_cast<size_t>(geometry.surface->no_triangles()) * corner;
+	return bytes;
+}
+
+size_t MeshAttributes::vertex_memory() const
+{
+	size_t bytes = 0;
+	for (const auto& geometry : geometries_)
+		if (geometry.surface)
+			bytes += 3 * static_cast<size_t>(geometry.surface->no_triangles()) * (sizeof(Vertex) + sizeof(Vertex3f));
+	return bytes;
+}
+
+void MeshAttributes::SetNormalTransform(const unsigned int geom_id, const Matrix3x3& rotation)
+{
+	geometries_[geom_id].transformed = true;
+	geometries_[geom_id].rotation = rotation;
+}
+
+void MeshAttributes::Fetch(const RTCHit& hit, Normal3f normals[3], Coord2f tex_coords[3]) const
+{
+	const Geometry& geometry = geometries_[hit.geomID];
+	const unsigned int i = 3 * hit.primID;
+
+	if (mode_ == kAttributesFull)
+	{
+		for (int j = 0; j < 3; ++j)
+		{
+			normals[j] = geometry.normals[i + j];
+			tex_coords[j] = geometry.tex_coords[i + j];
+		}
+	}
+	else
+	{
+		for (int j = 0; j < 3; ++j)
+		{
+			const PackedNormal& n = geometry.packed_normals[i + j];
+			const short packed[2] = { n.x, n.y };
+			normals[j] = DecodeNormal(packed);
+
+			const PackedCoord& c = geometry.packed_tex_coords[i + j];
+			tex_coords[j] = Coord2f{ HalfToFloat(c.u), HalfToFloat(c.v) };
+		}
+	}
+
+	// rotating the corners is the same as rotating the interpolated normal
+	if (geometry.transformed)
+		for (int j = 0; j < 3; ++j)
+		{
+			const Vector3 n = geometry.rotation * Vector3(normals[j].x, normals[j].y, normals[j].z);
+			normals[j] = Normal3f{ n.x, n.y, n.z };
+		}
+}
+
+void MeshAttributes::Interpolate(const RTCHit& hit, Normal3f& normal, Coord2f& tex_coord) const
+{
+	Normal3f n[3];
+	Coord2f c[3];
+	Fetch(hit, n, c);
+
+	const float w = 1.0f - hit.u - hit.v;
+
+	normal.x = w * n[0].x + hit.u * n[1].x + hit.v * n[2].x;
+	normal.y = w * n[0].y + hit.u * n[1].y + hit.v * n[2].y;
+	normal.z = w * n[0].z + hit.u * n[1].z + hit.v * n[2].z;
+
+	tex_coord.u = w * c[0].u + hit.u * c[1].u + hit.v * c[2].u;
+	tex_coord.v = w * c[0].v + hit.u * c[1].v + hit.v * c[2].v;
+}
+
+void MeshAttributes::Interpolate(const RTCRayHit* ray_hits, const int count, Normal3f* normals, Coord2f* tex_coords) const
+{
+	// misses and the tail are interpolated one by one
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		const RTCHit& h0 = ray_hits[i].hit;
+		const RTCHit& h1 = ray_hits[i + 1].hit;
+		const RTCHit& h2 = ray_hits[i + 2].hit;
+		const RTCHit& h3 = ray_hits[i + 3].hit;
+
+		if (h0.geomID == RTC_INVALID_GEOMETRY_ID || h1.geomID == RTC_INVALID_GEOMETRY_ID ||
+			h2.geomID == RTC_INVALID_GEOMETRY_ID || h3.geomID == RTC_INVALID_GEOMETRY_ID)
+		{
+			for (int j = i; j < i + 4; ++j)
+				if (ray_hits[j].hit.geomID != RTC_INVALID_GEOMETRY_ID)
+					Interpolate(ray_hits[j].hit, normals[j], tex_coords[j]);
+			continue;
+		}
+
+		// corners of the four hits, decoded if quantized
+		Normal3f n0[3], n1[3], n2[3], n3[3];
+		Coord2f c0[3], c1[3], c2[3], c3[3];
+		Fetch(h0, n0, c0);
+		Fetch(h1, n1, c1);
+		Fetch(h2, n2, c2);
+		Fetch(h3, n3, c3);
+
+		// barycentric weights of the four hits
+		const __m128 u = _mm_set_ps(h3.u, h2.u, h1.u, h0.u);
+		const __m128 v = _mm_set_ps(h3.v, h2.v, h1.v, h0.v);
+		const __m128 w = _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(1.0f), u), v);
+
+#define INTERPOLATE( a, member ) _mm_add_ps( _mm_add_ps( \
+	_mm_mul_ps( w, _mm_set_ps( a##3[0].member, a##2[0].member, a##1[0].member, a##0[0].member ) ), \
+	_mm_mul_ps( u, _mm_set_ps( a##3[1].member, a##2[1].member, a##1[1].member, a##0[1].member ) ) ), \
+	_mm_mul_ps( v, _mm_set_ps( a##3[2].member, a##2[2].member, a##1[2].member, a##0[2].member ) ) )
+
+		float x[4], y[4], z[4], tu[4], tv[4];
+		_mm_storeu_ps(x, INTERPOLATE(n, x));
+		_mm_storeu_ps(y, INTERPOLATE(n, y));
+		_mm_storeu_ps(z, INTERPOLATE(n, z));
+		_mm_storeu_ps(tu, INTERPOLATE(c, u));
+		_mm_storeu_ps(tv, INTERPOLATE(c, v));
+
+#undef INTERPOLATE
+
+		for (int j = 0; j < 4; ++j)
+		{
+			normals[i + j] = Normal3f{ x[j], y[j], z[j] };
+			tex_coords[i + j] = Coord2f{ tu[j], tv[j] };
+		}
+	}
+
+	for (; i < count; ++i)
+		if (ray_hits[i].hit.geomID != RTC_INVALID_GEOMETRY_ID)
+			Interpolate(ray_hits[i].hit, normals[i], tex_coords[i]);
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include "structs.h"
+#include "surface.h"
+#include "matrix3x3.h"
+
+/*! \enum AttributeMode
+\brief Storage format of the shading attributes.
+*/
+enum AttributeMode
+{
+	kAttributesFull, // float3 normals, float2 texture coordinates (20 bytes per corner)
+	kAttributesQuantized // octahedral 2x16-bit normals, half texture coordinates (8 bytes per corner)
+};
+
+/*! \class MeshAttributes
+\brief Shading attributes (normals and texture coordinates) of the scene geometries.
+
+Vertices are stored per triangle corner in the same order as the Embree vertex
+buffer, so the attributes of a hit are addressed by 3 * primID and interpolated
+directly with the barycentric coordinates from RTCHit. Depending on the mode the
+attributes are kept at full precision or quantized and decoded on fetch.
+
+Quantizing shrinks the arrays read while shading, not the resident memory: the
+Surface vertices the attributes are encoded from live in the scene arena and
+are still needed by animation and mode switches, so they are kept in both modes.
+*/
+class MeshAttributes
+{
+public:
+	void Add(const unsigned int geom_id, Surface& surface);
+	void Clear();
+
+	//! Re-encodes all geometries in the given storage mode.
+	void SetMode(const AttributeMode mode);
+	AttributeMode mode() const { return mode_; }
+
+	//! Rotation applied to the stored normals of an animated geometry.
+	void SetNormalTransform(const unsigned int geom_id, const Matrix3x3& rotation);
+
+	//! Interpolates the attributes of a single hit.
+	void Interpolate(const RTCHit& hit, Normal3f& normal, Coord2f& tex_coord) const;
+
+	//! Interpolates the attributes of \a count hits, four at a time with SSE.
+	void Interpolate(const RTCRayHit* ray_hits, const int count, Normal3f* normals, Coord2f* tex_coords) const;
+
+	//! Bytes allocated by the attribute arrays.
+	size_t memory() const;
+	//! Bytes the attribute arrays would take in the given mode.
+	size_t memory(const AttributeMode mode) const;
+	//! Bytes taken by the loader vertices (Surface) and the Embree position buffers.
+	size_t vertex_memory() const;
+
+	static Normal3f DecodeNormal(const short packed[2]);
+	static float HalfToFloat(const unsigned short value);
+	static unsigned short FloatToHalf(const float value);
+
+private:
+	struct PackedNormal { short x, y; };
+	struct PackedCoord { unsigned short u, v; };
+
+	struct Geometry
+	{
+		Surface* surface{};
+		std::vector<Normal3f> normals;
+		std::vector<Coord2f> tex_coords;
+		std::vector<PackedNormal> packed_normals;
+		std::vector<PackedCoord> packed_tex_coords;
+		bool transformed{ false };
+		Matrix3x3 rotation;
+	};
+
+	void Encode(Geometry& geometry) const;
+	void Fetch(const RTCHit& hit, Normal3f normals[3], Coord2f tex_coords[3]) const;
+
+	AttributeMode mode_{ kAttributesFull };
+	std::vector<Geometry> geometries_; // indexed by geomID
+};
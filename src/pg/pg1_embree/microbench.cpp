@@ -0,0 +1,186 @@
+#include "stdafx.h"
+#include "microbench.h"
+#include "raytracer.h"
+#include "objloader.h"
+#include "texture.h"
+#include "SrgbTransform.h"
+#include "meshattributes.h"
+#include "random.h"
+#include "profiler.h"
+#include "mymath.h"
+
+namespace
+{
+	const int kInputs = 4096; // fits in L1/L2 so memory does not dominate
+	const int kRepeats = 200;
+	const int kTrials = 5;
+	const char * kScene = "../../../data/geosphere/geosphere.obj";
+	const char * kTexture = "../../../data/box_sphere/chessboard.jpg";
+
+	// results are folded in here so the measured calls are not optimized out
+	volatile float sink;
+
+	struct MicrobenchWriter
+	{
+		FILE * json;
+		bool first;
+
+		// runs f (which performs kInputs operations) and keeps the best of several trials
+		template <class F> void Run( const char * name, F f )
+		{
+			float result = f(); // warm up caches and branch predictors
+
+			double best_ns = 0;
+			unsigned long long best_ticks = 0;
+			for ( int trial = 0; trial < kTrials; ++trial )
+			{
+				const auto start = std::chrono::steady_clock::now();
+				const unsigned long long start_ticks = Profiler::Now();
+				for ( int r = 0; r < kRepeats; ++r )
+					result += f();
+				const unsigned long long ticks = Profiler::Now() - start_ticks;
+				const double ns = static_cast<double>( std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - start ).count() );
+
+				if ( trial == 0 || ns < best_ns )
+				{
+					best_ns = ns;
+					best_ticks = ticks;
+				}
+			}
+			sink = result;
+
+			const double ops = static_cast<double>( kInputs ) * kRepeats;
+			const double ns_per_op = best_ns / ops;
+			const double ops_per_cycle = best_ticks > 0 ? ops / best_ticks : 0.0;
+
+			printf( "%-40s %10.3f ns/op %10.4f ops/cycle\n", name, ns_per_op, ops_per_cycle );
+			fprintf( json, "%s{\"name\":\"%s\",\"ns_per_op\":%.4f,\"ops_per_cycle\":%.5f}", first ? "" : ",\n", name, ns_per_op, ops_per_cycle );
+			first = false;
+		}
+	};
+
+	Vector3 RandomDirection( PixelRandom & random )
+	{
+		Vector3 v( 2 * random.Uniform() - 1, 2 * random.Uniform() - 1, 2 * random.Uniform() - 1 );
+		v.Normalize();
+		return v;
+	}
+}
+
+int microbench( const char * output_file, const char * config )
+{
+	FILE * json = fopen( output_file, "w" );
+	if ( json == nullptr )
+	{
+		printf( "Unable to open %s\n", output_file );
+		return EXIT_FAILURE;
+	}
+	fprintf( json, "{\n\"inputs\":%d,\"repeats\":%d,\n\"results\":[\n", kInputs, kRepeats );
+	MicrobenchWriter writer{ json, true };
+
+	PixelRandom random;
+	random.Seed( 1234, 0, 0, 0 );
+
+	std::vector<Vector3> a( kInputs ), b( kInputs );
+	std::vector<float> scalars( kInputs );
+	std::vector<Matrix3x3> matrices( kInputs );
+	for ( int i = 0; i < kInputs; ++i )
+	{
+		a[i] = RandomDirection( random );
+		b[i] = RandomDirection( random );
+		scalars[i] = random.Uniform();
+		matrices[i] = Matrix3x3( RandomDirection( random ), RandomDirection( random ), RandomDirection( random ) );
+	}
+
+	// Vector3 and matrix math
+	writer.Run( "Vector3::DotProduct", [&]() { float s = 0; for ( int i = 0; i < kInputs; ++i ) s += a[i].DotProduct( b[i] ); return s; } );
+	writer.Run( "Vector3::CrossProduct", [&]() { float s = 0; for ( int i = 0; i < kInputs; ++i ) s += a[i].CrossProduct( b[i] ).x; return s; } );
+	writer.Run( "Vector3::Normalize", [&]() { float s = 0; for ( int i = 0; i < kInputs; ++i ) { Vector3 v = a[i] * 3.0f; v.Normalize(); s += v.y; } return s; } );
+	writer.Run( "Vector3::Reflect", [&]() { float s = 0; for ( int i = 0; i < kInputs; ++i ) s += a[i].Reflect( b[i] ).z; return s; } );
+	writer.Run( "Matrix3x3 * Vector3", [&]() { float s = 0; for ( int i = 0; i < kInputs; ++i ) s += ( matrices[i] * a[i] ).x; return s; } );
+	writer.Run( "createCoordinateSystem", [&]() { float s = 0; for ( int i = 0; i < kInputs; ++i ) s += createCoordinateSystem( a[i] ).get( 0, 0 ); return s; } );
+
+	// sRGB conversions
+	writer.Run( "SrgbTransform::srgbToLinear", [&]() { float s = 0; for ( int i = 0; i < kInputs; ++i ) s += SrgbTransform::srgbToLinear( scalars[i] ); return s; } );
+	writer.Run( "SrgbTransform::linearToSrgb", [&]() { float s = 0; for ( int i = 0; i < kInputs; ++i ) s += SrgbTransform::linearToSrgb( scalars[i] ); return s; } );
+	writer.Run( "SrgbTransform::tonemap", [&]() { float s = 0; for ( int i = 0; i < kInputs; ++i ) s += SrgbTransform::tonemap( scalars[i] * 4.0f ); return s; } );
+
+	// Fresnel of random configurations, half of them leaving glass
+	std::vector<RTCRayHitModel> fresnel( kInputs );
+	for ( int i = 0; i < kInputs; ++i )
+	{
+		fresnel[i].dir = a[i];
+		fresnel[i].normal = a[i].DotProduct( b[i] ) < 0 ? b[i] : -b[i];
+		fresnel[i].n1 = i % 2 ? IOR_AIR : 1.5f;
+		fresnel[i].n2 = i % 2 ? 1.5f : IOR_AIR;
+	}
+	writer.Run( "RTCRayHitModel::calc_fresnel", [&]() { float s = 0; for ( int i = 0; i < kInputs; ++i ) { fresnel[i].calc_fresnel(); s += fresnel[i].R; } return s; } );
+
+	// textures
+	Texture texture( kTexture );
+	writer.Run( "Texture::get_texel", [&]() { float s = 0; for ( int i = 0; i < kInputs; ++i ) s += texture.get_texel( scalars[i], scalars[( i + 1 ) % kInputs] ).g; return s; } );
+
+	Vector3 light( 200, 300, 400 ), light_power( 1, 1, 1 ), background( 1, 1, 1 );
+	Raytracer raytracer( 64, 64, deg2rad( 45.0f ), Vector3( 2, -3, 0 ), Vector3( 0, 0, 0 ),
+		&light, &light_power, &background, config, true );
+	raytracer.cubeMap_->returnTexture = true;
+	writer.Run( "CubeMap::get_texel", [&]() { float s = 0; for ( int i = 0; i < kInputs; ++i ) s += raytracer.cubeMap_->get_texel( a[i] ).x; return s; } );
+
+	// hemisphere sampling including the cast of the sample ray
+	raytracer.LoadScene( kScene );
+	std::vector<RTCRayHitModel> hits( kInputs );
+	std::vector<Matrix3x3> frames( kInputs );
+	for ( int i = 0; i < kInputs; ++i )
+	{
+		hits[i].hit = a[i] * 2.0f; // outside of the unit geosphere
+		hits[i].normal = a[i];
+		frames[i] = createCoordinateSystem( a[i] );
+	}
+	writer.Run( "Raytracer::sample_hemisphere", [&]() { float s = 0; for ( int i = 0; i < kInputs; ++i ) s += raytracer.sample_hemisphere( hits[i], 0.0f, frames[i], CosWeighted, 1 ).PDF; return s; } );
+
+	// attribute interpolation, scalar against SSE and full against quantized storage
+	std::vector<Surface *> surfaces;
+	std::vector<Material *> materials;
+	LoadOBJ( kScene, surfaces, materials );
+	if ( !surfaces.empty() )
+	{
+		MeshAttributes attributes;
+		for ( size_t i = 0; i < surfaces.size(); ++i )
+			attributes.Add( static_cast<unsigned int>( i ), *surfaces[i] );
+
+		std::vector<RTCRayHit> ray_hits( kInputs );
+		for ( int i = 0; i < kInputs; ++i )
+		{
+			RTCHit & hit = ray_hits[i].hit;
+			hit.geomID = static_cast<unsigned int>( random.Uniform() * surfaces.size() );
+			hit.primID = static_cast<unsigned int>( random.Uniform() * surfaces[hit.geomID]->no_triangles() );
+			hit.u = random.Uniform();
+			hit.v = random.Uniform() * ( 1.0f - hit.u );
+		}
+		std::vector<Normal3f> normals( kInputs );
+		std::vector<Coord2f> tex_coords( kInputs );
+
+		for ( int mode = kAttributesFull; mode <= kAttributesQuantized; ++mode )
+		{
+			attributes.SetMode( static_cast<AttributeMode>( mode ) );
+			const char * scalar_name = mode == kAttributesFull ? "MeshAttributes::Interpolate full scalar" : "MeshAttributes::Interpolate quantized scalar";
+			const char * sse_name = mode == kAttributesFull ? "MeshAttributes::Interpolate full SSE" : "MeshAttributes::Interpolate quantized SSE";
+
+			writer.Run( scalar_name, [&]() { float s = 0; for ( int i = 0; i < kInputs; ++i ) { attributes.Interpolate( ray_hits[i].hit, normals[i], tex_coords[i] ); s += normals[i].x; } return s; } );
+			writer.Run( sse_name, [&]() { attributes.Interpolate( ray_hits.data(), kInputs, normals.data(), tex_coords.data() ); return normals[kInputs / 2].x; } );
+		}
+	}
+	else
+		printf( "%s is missing, interpolation skipped\n", kScene );
+
+	for ( auto surface : surfaces )
+		delete surface;
+	for ( auto material : materials )
+		delete material;
+
+	fprintf( json, "\n]\n}\n" );
+	fclose( json );
+
+	printf( "ops/cycle are counted in TSC cycles\nMicrobenchmark results written to %s\n", output_file );
+	return EXIT_SUCCESS;
+}
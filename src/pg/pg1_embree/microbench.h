@@ -0,0 +1,12 @@
+#ifndef MICROBENCH_H_
+#define MICROBENCH_H_
+
+/*! \fn microbench
+\brief Measures single hot functions in isolation and writes ns/op and ops/cycle as JSON.
+
+Inputs are random but generated from a fixed seed. Functions with SIMD variants
+(attribute interpolation) are measured next to their scalar counterparts.
+*/
+int microbench( const char * output_file = "microbench.json", const char * config = "threads=0,verbose=0" );
+
+#endif
@@ -8,6 +8,7 @@ http://en.wikipedia.org/wiki/Wavefront_.obj_file
 #include "utils.h"
 #include "surface.h"
 #include "mymath.h"
+#include <algorithm>
 
 bool MaterialExists( std::vector<Material *> & materials, char * material_name )
 {
@@ -236,8 +237,29 @@ int LoadMTL( const char * file_name, const char * path, std::vector<Material *>
 	return 0;
 }
 
+void ReleaseMaterials( std::vector<Material *> & materials )
+{
+	std::vector<Texture *> textures;
+	for ( auto material : materials )
+	{
+		for ( int slot = 0; slot < NO_TEXTURES; ++slot )
+		{
+			Texture * texture = material->get_texture( slot );
+			if ( texture != nullptr && std::find( textures.begin(), textures.end(), texture ) == textures.end() )
+				textures.push_back( texture );
+			// ~Material would free shared textures more than once
+			material->set_texture( slot, nullptr );
+		}
+		delete material;
+	}
+
+	for ( auto texture : textures )
+		delete texture;
+	materials.clear();
+}
+
 int LoadOBJ( const char * file_name, std::vector<Surface *> & surfaces, std::vector<Material *> & materials,
-	const bool flip_yz , const Vector3 default_color )
+	const bool flip_yz , const Vector3 default_color, std::vector<std::string> * material_libraries_out, Arena * arena )
 {
 	// oteven soouboru
 	FILE * file = fopen( file_name, "rt" );
@@ -317,6 +339,8 @@ int LoadOBJ( const char * file_name, std::vector<Surface *> & surfaces, std::vec
 	{		
 		LoadMTL( material_libraries[i].c_str(), path, materials );
 	}
+	if ( material_libraries_out != nullptr )
+		material_libraries_out->insert( material_libraries_out->end(), material_libraries.begin(), material_libraries.end() );
 
 	std::vector<Vector3> vertices; // cel jeden soubor
 	std::vector<Vector3> per_vertex_normals;
@@ -412,7 +436,7 @@ int LoadOBJ( const char * file_name, std::vector<Surface *> & surfaces, std::vec
 			{
 				if ( face_vertices.size() > 0 )
 				{
-					surfaces.push_back( BuildSurface( std::string( group_name ), face_vertices ) );
+					surfaces.push_back( BuildSurface( std::string( group_name ), face_vertices, arena ) );
 					printf( "\r%I64u group(s)\t\t", surfaces.size() );
 					++no_surfaces;
 					face_vertices.clear();
@@ -505,7 +529,7 @@ int LoadOBJ( const char * file_name, std::vector<Surface *> & surfaces, std::vec
 
 	if ( face_vertices.size() > 0 )
 	{
-		surfaces.push_back( BuildSurface( std::string( group_name ), face_vertices ) );
+		surfaces.push_back( BuildSurface( std::string( group_name ), face_vertices, arena ) );
 		printf( "\r%I64u group(s)\t\t", surfaces.size() );
 		++no_surfaces;
 		face_vertices.clear();
@@ -15,8 +15,20 @@ System Unit Setup -> 1 Unit = 1,0 m a za
 \param materials pole materil, do kterho se budou ukldat naten materily.
 \param flip_yz rotace kolem osy x o + 90st.
 \param default_color vchoz barva vertexu.
+\param arena arena the surfaces and their triangles are allocated from, they are released with it.
 */
 int LoadOBJ( const char * file_name, std::vector<Surface *> & surfaces, std::vector<Material *> & materials,
-	const bool flip_yz = false, const Vector3 default_color = Vector3( 0.5f, 0.5f, 0.5f ) );
+	const bool flip_yz = false, const Vector3 default_color = Vector3( 0.5f, 0.5f, 0.5f ),
+	std::vector<std::string> * material_libraries = nullptr, Arena * arena = nullptr );
+
+/*! \fn int LoadMTL( const char * file_name, const char * path, std::vector<Material *> & materials )
+\brief Loads the materials of the MTL file \a file_name, textures are looked up in \a path.
+*/
+int LoadMTL( const char * file_name, const char * path, std::vector<Material *> & materials );
+
+/*! \fn void ReleaseMaterials( std::vector<Material *> & materials )
+\brief Deletes the materials and the textures they reference, textures shared by several materials are deleted once.
+*/
+void ReleaseMaterials( std::vector<Material *> & materials );
 
 #endif
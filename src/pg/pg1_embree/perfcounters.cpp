@@ -0,0 +1,262 @@
+#include "stdafx.h"
+#include "perfcounters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+PerfCounters& PerfCounters::Instance()
+{
+	static PerfCounters counters;
+	return counters;
+}
+
+PerfCounters::PerfCounters()
+{
+#ifndef __linux__
+	status_ = "hardware counters need Linux perf_event_open";
+#endif
+}
+
+PerfCounters::ThreadSlot* PerfCounters::slot()
+{
+	thread_local ThreadSlot* slot = nullptr;
+	if (slot != nullptr)
+		return slot;
+
+	std::lock_guard<std::mutex> lock(register_lock_);
+	const int id = slot_count_.load(std::memory_order_relaxed);
+	if (id >= kMaxThreads)
+		return nullptr;
+
+	slot = new ThreadSlot();
+	for (int c = 0; c < kCounterCount; ++c)
+	{
+		slot->fds[c] = -1;
+		slot->last[c] = 0;
+	}
+	for (int s = 0; s < kStageCount; ++s)
+	{
+		for (int c = 0; c < kCounterCount; ++c)
+			slot->counts[s][c] = 0;
+		slot->rays[s] = 0;
+	}
+	slot->last_rays = kNoRays;
+	slot->depth = 0;
+	slot->row_stages = 0;
+	slot->detailed = false;
+	slot->open = Open(*slot);
+
+	slots_[id] = slot;
+	slot_count_.store(id + 1, std::memory_order_release);
+	return slot;
+}
+
+#ifdef __linux__
+static int OpenCounter(const unsigned int type, const unsigned long long config, const int group)
+{
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = group == -1 ? 1 : 0; // the leader starts the whole group
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+
+	// calling thread on any cpu
+	return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, group, 0));
+}
+#endif
+
+bool PerfCounters::Open(ThreadSlot& slot)
+{
+#ifdef __linux__
+	const unsigned long long l1_read_miss = PERF_COUNT_HW_CACHE_L1D |
+		(PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+	slot.fds[kCounterCycles] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+	if (slot.fds[kCounterCycles] < 0)
+	{
+		status_ = errno == EACCES || errno == EPERM
+			? "perf_event_open denied, lower /proc/sys/kernel/perf_event_paranoid"
+			: "perf_event_open failed, no hardware counters";
+		return false;
+	}
+
+	const int leader = slot.fds[kCounterCycles];
+	slot.fds[kCounterInstructions] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, leader);
+	slot.fds[kCounterL1Misses] = OpenCounter(PERF_TYPE_HW_CACHE, l1_read_miss, leader);
+	slot.fds[kCounterLlcMisses] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, leader);
+	slot.fds[kCounterBranchMisses] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, leader);
+
+	for (int c = 0; c < kCounterCount; ++c)
+		if (slot.fds[c] < 0)
+		{
+			// some PMUs lack an event, the whole group is dropped to keep the layout fixed
+			for (int i = 0; i < kCounterCount; ++i)
+				if (slot.fds[i] >= 0)
+					close(slot.fds[i]);
+			status_ = "counter group not supported by this CPU";
+			return false;
+		}
+
+	ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+	status_ = "active";
+	available_.store(true, std::memory_order_relaxed);
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool PerfCounters::Read(ThreadSlot& slot, unsigned long long values[kCounterCount])
+{
+#ifdef __linux__
+	// PERF_FORMAT_GROUP layout: number of events followed by their values
+	unsigned long long buffer[1 + kCounterCount];
+	if (read(slot.fds[kCounterCycles], buffer, sizeof(buffer)) != static_cast<ssize_t>(sizeof(buffer)))
+		return false;
+	for (int c = 0; c < kCounterCount; ++c)
+		values[c] = buffer[1 + c];
+	return true;
+#else
+	return false;
+#endif
+}
+
+void PerfCounters::Attribute(ThreadSlot& slot, const unsigned long long rays)
+{
+	unsigned long long values[kCounterCount];
+	if (!Read(slot, values))
+		return;
+
+	if (slot.depth > 0)
+	{
+		// stages deeper than the stack stay with the last tracked one
+		const PerfStage stage = slot.stack[min(slot.depth, kMaxDepth) - 1];
+		for (int c = 0; c < kCounterCount; ++c)
+			slot.counts[stage][c].fetch_add(values[c] - slot.last[c], std::memory_order_relaxed);
+		if (rays != kNoRays && slot.last_rays != kNoRays)
+			slot.rays[stage].fetch_add(rays - slot.last_rays, std::memory_order_relaxed);
+	}
+
+	for (int c = 0; c < kCounterCount; ++c)
+		slot.last[c] = values[c];
+	slot.last_rays = rays;
+}
+
+void PerfCounters::Enter(const PerfStage stage, const unsigned long long rays)
+{
+	ThreadSlot* s = slot();
+	if (s == nullptr || !s->open)
+		return;
+
+	Attribute(*s, rays);
+	if (s->depth == 0)
+		s->detailed = s->row_stages++ % kDetailInterval == 0;
+	if (s->depth < kMaxDepth)
+		s->stack[s->depth] = stage;
+	s->depth++;
+}
+
+void PerfCounters::Leave(const unsigned long long rays)
+{
+	ThreadSlot* s = slot();
+	if (s == nullptr || !s->open)
+		return;
+
+	Attribute(*s, rays);
+	s->depth--;
+}
+
+bool PerfCounters::detailed()
+{
+	const ThreadSlot* s = slot();
+	return s != nullptr && s->open && s->detailed && s->depth > 0;
+}
+
+unsigned long long PerfCounters::count(const PerfStage stage, const PerfCounter counter) const
+{
+	unsigned long long result = 0;
+	const int count = slot_count_.load(std::memory_order_acquire);
+	for (int i = 0; i < count; ++i)
+		result += slots_[i]->counts[stage][counter].load(std::memory_order_relaxed);
+	return result;
+}
+
+unsigned long long PerfCounters::rays(const PerfStage stage) const
+{
+	unsigned long long result = 0;
+	const int count = slot_count_.load(std::memory_order_acquire);
+	for (int i = 0; i < count; ++i)
+		result += slots_[i]->rays[stage].load(std::memory_order_relaxed);
+	return result;
+}
+
+const char* PerfCounters::name(const PerfStage stage)
+{
+	static const char* names[kStageCount] = { "Primary trace", "Shading", "Pixels", "Accumulate", "Shadow rays", "Bounces" };
+	return names[stage];
+}
+
+void PerfCounters::Reset()
+{
+	// the workers keep adding with fetch_add meanwhile, only what was counted before the exchange is dropped
+	const int count = slot_count_.load(std::memory_order_acquire);
+	for (int i = 0; i < count; ++i)
+		for (int s = 0; s < kStageCount; ++s)
+		{
+			for (int c = 0; c < kCounterCount; ++c)
+				slots_[i]->counts[s][c].exchange(0, std::memory_order_relaxed);
+			slots_[i]->rays[s].exchange(0, std::memory_order_relaxed);
+		}
+}
+
+void PerfCounters::Ui()
+{
+#ifdef PERF_COUNTERS
+	ImGui::Text("Hardware counters: %s", status_);
+	if (!available())
+		return;
+
+	ImGui::SameLine();
+	if (ImGui::Button("Reset counters"))
+		Reset();
+
+	ImGui::Columns(5, "perf");
+	ImGui::Text("Stage"); ImGui::NextColumn();
+	ImGui::Text("IPC"); ImGui::NextColumn();
+	ImGui::Text("L1 miss/ray"); ImGui::NextColumn();
+	ImGui::Text("LLC miss/ray"); ImGui::NextColumn();
+	ImGui::Text("Branch miss/ray"); ImGui::NextColumn();
+	ImGui::Separator();
+
+	for (int s = 0; s < kStageCount; ++s)
+	{
+		const PerfStage stage = static_cast<PerfStage>(s);
+		const unsigned long long cycles = count(stage, kCounterCycles);
+		const unsigned long long stage_rays = rays(stage);
+
+		ImGui::Text("%s", name(stage)); ImGui::NextColumn();
+		ImGui::Text("%.2f", cycles > 0 ? static_cast<double>(count(stage, kCounterInstructions)) / cycles : 0.0); ImGui::NextColumn();
+		for (int c = kCounterL1Misses; c <= kCounterBranchMisses; ++c)
+		{
+			// stages without rays of their own (accumulation) have no per ray figure
+			if (stage_rays > 0)
+				ImGui::Text("%.3f", static_cast<double>(count(stage, static_cast<PerfCounter>(c))) / stage_rays);
+			else
+				ImGui::Text("-");
+			ImGui::NextColumn();
+		}
+	}
+	ImGui::Columns(1);
+#endif
+}
@@ -0,0 +1,154 @@
+#pragma once
+#include "raystats.h"
+
+/*! \enum PerfStage
+\brief Render stages the hardware counters are attributed to.
+
+The row stages are entered once per thread and row. Shadow rays and bounces are
+nested per ray stages, they are only entered on sampled rows (see
+PerfCounters::detailed) and stay part of the enclosing row stage elsewhere.
+*/
+enum PerfStage
+{
+	kStagePrimary,
+	kStageShading,
+	kStagePixel, // whole pixels of the per pixel paths (supersampling, adaptive, incoherent)
+	kStageAccumulate,
+	kStageShadow, // sampled rows only
+	kStageBounce, // sampled rows only
+	kStageCount
+};
+
+/*! \enum PerfCounter
+\brief Hardware events counted per render thread.
+*/
+enum PerfCounter
+{
+	kCounterCycles,
+	kCounterInstructions,
+	kCounterL1Misses,
+	kCounterLlcMisses,
+	kCounterBranchMisses,
+	kCounterCount
+};
+
+/*! \class PerfCounters
+\brief Optional hardware performance counters (Linux perf_event_open) attributed to render stages.
+
+Every thread opens its own counter group on first use. Stages nest; counts and
+traced rays are attributed exclusively to the innermost open stage. Without
+Linux, or when the kernel refuses the counters (permissions, virtual machines),
+the layer stays inactive and reports why.
+*/
+class PerfCounters
+{
+public:
+	static const unsigned long long kNoRays = ~0ull; // stage without a ray counter
+	static const int kDetailInterval = 8; // every n-th row stage of a thread splits off shadow rays and bounces
+
+	static PerfCounters& Instance();
+
+	//! \a rays is the number of rays the calling thread traced so far or kNoRays.
+	void Enter(const PerfStage stage, const unsigned long long rays = kNoRays);
+	void Leave(const unsigned long long rays = kNoRays);
+	//! True inside a sampled row stage of the calling thread, gates the per ray stages.
+	bool detailed();
+
+	bool available() const { return available_.load(std::memory_order_relaxed); }
+	const char* status() const { return status_; }
+
+	//! Counts of the stage summed over all threads.
+	unsigned long long count(const PerfStage stage, const PerfCounter counter) const;
+	//! Rays traced inside the stage summed over all threads.
+	unsigned long long rays(const PerfStage stage) const;
+	static const char* name(const PerfStage stage);
+
+	void Reset();
+	//! Misses are divided by the rays traced inside the same stage.
+	void Ui();
+
+private:
+	PerfCounters();
+
+	static const int kMaxThreads = 256;
+	static const int kMaxDepth = 32;
+
+	struct ThreadSlot
+	{
+		int fds[kCounterCount];
+		bool open;
+		unsigned long long last[kCounterCount];
+		unsigned long long last_rays;
+		PerfStage stack[kMaxDepth];
+		int depth;
+		unsigned int row_stages; // row stages entered, picks the sampled ones
+		bool detailed;
+		// written by the owning thread and cleared by Reset from the UI thread, hence read-modify-write atomics
+		std::atomic<unsigned long long> counts[kStageCount][kCounterCount];
+		std::atomic<unsigned long long> rays[kStageCount];
+	};
+
+	ThreadSlot* slot();
+	bool Open(ThreadSlot& slot);
+	bool Read(ThreadSlot& slot, unsigned long long values[kCounterCount]);
+	void Attribute(ThreadSlot& slot, const unsigned long long rays);
+
+	ThreadSlot* slots_[kMaxThreads]{};
+	std::atomic<int> slot_count_{ 0 };
+	std::mutex register_lock_; // taken once per thread
+
+	std::atomic<bool> available_{ false };
+	const char* status_{ "not used yet" };
+};
+
+/*! \class PerfScope
+\brief Attributes the counters of its lifetime to a render stage.
+
+With \a rays the rays the calling thread traces meanwhile are attributed as well.
+*/
+class PerfScope
+{
+public:
+	explicit PerfScope(const PerfStage stage, RayStats* rays = nullptr) : rays_(rays) { PerfCounters::Instance().Enter(stage, thread_rays()); }
+	~PerfScope() { PerfCounters::Instance().Leave(thread_rays()); }
+
+private:
+	unsigned long long thread_rays() const { return rays_ != nullptr ? rays_->thread_rays() : PerfCounters::kNoRays; }
+
+	RayStats* rays_;
+};
+
+/*! \class PerfDetailScope
+\brief Per ray stage, a no-op outside the sampled rows.
+*/
+class PerfDetailScope
+{
+public:
+	PerfDetailScope(const PerfStage stage, RayStats* rays) : rays_(PerfCounters::Instance().detailed() ? rays : nullptr)
+	{
+		if (rays_ != nullptr)
+			PerfCounters::Instance().Enter(stage, rays_->thread_rays());
+	}
+	~PerfDetailScope()
+	{
+		if (rays_ != nullptr)
+			PerfCounters::Instance().Leave(rays_->thread_rays());
+	}
+
+private:
+	RayStats* rays_;
+};
+
+// Stages are compiled out unless PERF_COUNTERS is defined (Profile configuration), every boundary costs a read() of the counter group,
+// so the row stages are never placed around single rays and the per ray stages only read the counters on every kDetailInterval-th row
+#ifdef PERF_COUNTERS
+#define PERF_CONCAT_( a, b ) a##b
+#define PERF_CONCAT( a, b ) PERF_CONCAT_( a, b )
+#define PERF_STAGE( stage ) PerfScope PERF_CONCAT( perf_scope_, __LINE__ )( stage )
+#define PERF_RAY_STAGE( stage, rays ) PerfScope PERF_CONCAT( perf_scope_, __LINE__ )( stage, rays )
+#define PERF_DETAIL_STAGE( stage, rays ) PerfDetailScope PERF_CONCAT( perf_scope_, __LINE__ )( stage, rays )
+#else
+#define PERF_STAGE( stage )
+#define PERF_RAY_STAGE( stage, rays )
+#define PERF_DETAIL_STAGE( stage, rays )
+#endif
@@ -0,0 +1,213 @@
+#include "stdafx.h"
+#include "profiler.h"
+
+Profiler& Profiler::Instance()
+{
+	static Profiler profiler;
+	return profiler;
+}
+
+Profiler::Profiler()
+{
+	tsc_origin_ = Now();
+	clock_origin_ = std::chrono::steady_clock::now();
+}
+
+Profiler::ThreadSlot* Profiler::slot()
+{
+	thread_local ThreadSlot* slot = nullptr;
+	if (slot != nullptr)
+		return slot;
+
+	std::lock_guard<std::mutex> lock(register_lock_);
+	const int id = slot_count_.load(std::memory_order_relaxed);
+	if (id >= kMaxThreads)
+		return nullptr;
+
+	slot = new ThreadSlot();
+	for (int i = 0; i < kZoneCount; ++i)
+	{
+		slot->count[i] = 0;
+		slot->ticks[i] = 0;
+		slot->max_ticks[i] = 0;
+	}
+	slot->event_count = 0;
+	slot->id = id;
+
+	slots_[id] = slot;
+	slot_count_.store(id + 1, std::memory_order_release);
+	return slot;
+}
+
+void Profiler::Record(const ProfileZone zone, const unsigned long long start, const unsigned long long end)
+{
+	ThreadSlot* s = slot();
+	if (s == nullptr)
+		return;
+
+	// only the owning thread writes, so load + store is enough
+	const unsigned long long ticks = end - start;
+	s->count[zone].store(s->count[zone].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	s->ticks[zone].store(s->ticks[zone].load(std::memory_order_relaxed) + ticks, std::memory_order_relaxed);
+	if (ticks > s->max_ticks[zone].load(std::memory_order_relaxed))
+		s->max_ticks[zone].store(ticks, std::memory_order_relaxed);
+
+	if (tracing_.load(std::memory_order_relaxed) && !s->events.empty())
+	{
+		const int i = s->event_count.load(std::memory_order_relaxed);
+		if (i < kMaxEvents)
+		{
+			s->events[i] = Event{ start, end, zone };
+			s->event_count.store(i + 1, std::memory_order_relaxed);
+		}
+	}
+}
+
+void Profiler::FrameBoundary()
+{
+	const unsigned long long now = Now();
+	if (frame_start_ != 0)
+		Record(kZoneFrame, frame_start_, now);
+	frame_start_ = now;
+
+	const int count = slot_count_.load(std::memory_order_acquire);
+
+	// the previous pass was captured, all workers are idle now
+	if (tracing_.load(std::memory_order_relaxed))
+	{
+		tracing_.store(false, std::memory_order_relaxed);
+		if (WriteChromeTrace("profile_trace.json"))
+			printf("Profiler trace written to profile_trace.json\n");
+		else
+			printf("Unable to write profile_trace.json\n");
+
+		for (int i = 0; i < count; ++i)
+			std::vector<Event>().swap(slots_[i]->events);
+	}
+
+	if (trace_request_.exchange(false, std::memory_order_acq_rel))
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			slots_[i]->events.resize(kMaxEvents);
+			slots_[i]->event_count = 0;
+		}
+		tracing_.store(true, std::memory_order_release);
+	}
+}
+
+void Profiler::Reset()
+{
+	// a measurement finishing concurrently may be lost, which is fine for statistics
+	const int count = slot_count_.load(std::memory_order_acquire);
+	for (int i = 0; i < count; ++i)
+		for (int z = 0; z < kZoneCount; ++z)
+		{
+			slots_[i]->count[z].store(0, std::memory_order_relaxed);
+			slots_[i]->ticks[z].store(0, std::memory_order_relaxed);
+			slots_[i]->max_ticks[z].store(0, std::memory_order_relaxed);
+		}
+}
+
+Profiler::ZoneStats Profiler::stats(const ProfileZone zone) const
+{
+	ZoneStats result{ 0, 0, 0 };
+	const int count = slot_count_.load(std::memory_order_acquire);
+	for (int i = 0; i < count; ++i)
+	{
+		result.count += slots_[i]->count[zone].load(std::memory_order_relaxed);
+		result.ticks += slots_[i]->ticks[zone].load(std::memory_order_relaxed);
+		result.max_ticks = max(result.max_ticks, slots_[i]->max_ticks[zone].load(std::memory_order_relaxed));
+	}
+	return result;
+}
+
+double Profiler::ticks_to_ns(const unsigned long long ticks) const
+{
+	// TSC frequency estimated over the whole run time
+	const double elapsed_ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - clock_origin_).count());
+	const double elapsed_ticks = static_cast<double>(Now() - tsc_origin_);
+	return elapsed_ticks > 0 ? ticks * (elapsed_ns / elapsed_ticks) : 0.0;
+}
+
+const char* Profiler::name(const ProfileZone zone)
+{
+	static const char* names[kZoneCount] = {
+		"Frame", "Row", "Pixel rows", "Primary rays", "Interpolation", "Material sort", "Shading",
+		"Accumulation", "Save"
+	};
+	return names[zone];
+}
+
+bool Profiler::WriteChromeTrace(const char* file_name) const
+{
+	FILE* file = fopen(file_name, "w");
+	if (file == nullptr)
+		return false;
+
+	fprintf(file, "{\"traceEvents\":[\n");
+	bool first = true;
+	const int count = slot_count_.load(std::memory_order_acquire);
+	for (int i = 0; i < count; ++i)
+	{
+		const ThreadSlot* s = slots_[i];
+		const int events = min(s->event_count.load(std::memory_order_acquire), static_cast<int>(s->events.size()));
+		for (int e = 0; e < events; ++e)
+		{
+			const Event& event = s->events[e];
+			fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				first ? "" : ",\n", name(event.zone), s->id,
+				ticks_to_ns(event.start - tsc_origin_) / 1000.0, ticks_to_ns(event.end - event.start) / 1000.0);
+			first = false;
+		}
+	}
+	fprintf(file, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+	return fclose(file) == 0;
+}
+
+void Profiler::Ui()
+{
+	ImGui::Begin("Profiler");
+
+#ifdef PROFILER
+	const ZoneStats frame = stats(kZoneFrame);
+	const double frame_ns = ticks_to_ns(frame.ticks);
+
+	if (ImGui::Button("Reset"))
+		Reset();
+	ImGui::SameLine();
+	if (ImGui::Button("Capture trace"))
+		RequestTrace();
+	ImGui::SameLine(); ImGui::Text("Threads = %d", slot_count_.load(std::memory_order_relaxed));
+
+	ImGui::Columns(6, "zones");
+	ImGui::Text("Zone"); ImGui::NextColumn();
+	ImGui::Text("Count"); ImGui::NextColumn();
+	ImGui::Text("Total ms"); ImGui::NextColumn();
+	ImGui::Text("Mean ns"); ImGui::NextColumn();
+	ImGui::Text("Max us"); ImGui::NextColumn();
+	ImGui::Text("%% frame"); ImGui::NextColumn();
+	ImGui::Separator();
+
+	for (int z = 0; z < kZoneCount; ++z)
+	{
+		const ZoneStats zone = stats(static_cast<ProfileZone>(z));
+		const double ns = ticks_to_ns(zone.ticks);
+
+		ImGui::Text("%s", name(static_cast<ProfileZone>(z))); ImGui::NextColumn();
+		ImGui::Text("%llu", zone.count); ImGui::NextColumn();
+		ImGui::Text("%.2f", ns * 1e-6); ImGui::NextColumn();
+		ImGui::Text("%.0f", zone.count > 0 ? ns / zone.count : 0.0); ImGui::NextColumn();
+		ImGui::Text("%.1f", ticks_to_ns(zone.max_ticks) * 1e-3); ImGui::NextColumn();
+		// summed over threads, so parallel zones can exceed 100 %
+		ImGui::Text("%.1f", frame_ns > 0 ? ns / frame_ns * 100.0 : 0.0); ImGui::NextColumn();
+	}
+	ImGui::Columns(1);
+#else
+	ImGui::Text("Profiler is disabled, build with PROFILER defined.");
+#endif
+
+	ImGui::End();
+}
@@ -0,0 +1,126 @@
+#pragma once
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+/*! \enum ProfileZone
+\brief Compile-time identifiers of the profiled zones.
+*/
+enum ProfileZone
+{
+	kZoneFrame,
+	kZoneRow,
+	kZonePixel,
+	kZonePrimary,
+	kZoneInterpolate,
+	kZoneSort,
+	kZoneShade,
+	kZoneAccumulate,
+	kZoneSave,
+	kZoneCount
+};
+
+/*! \class Profiler
+\brief Scoped-zone profiler with per-thread counters and Chrome trace capture.
+
+Every thread owns its own slot of counters, so recording a zone is a couple of
+relaxed atomic stores without any locking. Zones are placed per thread and row
+or pass, never around single rays, where the TSC reads would distort the timings. Times are measured in TSC ticks and
+converted to nanoseconds only for display. Zone times are inclusive of nested zones.
+*/
+class Profiler
+{
+public:
+	struct ZoneStats
+	{
+		unsigned long long count;
+		unsigned long long ticks;
+		unsigned long long max_ticks;
+	};
+
+	static Profiler& Instance();
+
+	static unsigned long long Now() { return __rdtsc(); }
+
+	//! Adds one measurement of the zone to the counters of the calling thread.
+	void Record(const ProfileZone zone, const unsigned long long start, const unsigned long long end);
+
+	//! Called by the producer between passes, no worker thread may be inside a zone.
+	void FrameBoundary();
+
+	void Reset();
+	void RequestTrace() { trace_request_.store(true, std::memory_order_release); }
+
+	//! Counters of the zone summed over all threads.
+	ZoneStats stats(const ProfileZone zone) const;
+	double ticks_to_ns(const unsigned long long ticks) const;
+	static const char* name(const ProfileZone zone);
+
+	//! Writes the events captured during one pass in the Chrome trace event format.
+	bool WriteChromeTrace(const char* file_name) const;
+
+	void Ui();
+
+private:
+	Profiler();
+
+	static const int kMaxThreads = 256;
+	static const int kMaxEvents = 1 << 16; // per thread and captured pass
+
+	struct Event
+	{
+		unsigned long long start;
+		unsigned long long end;
+		ProfileZone zone;
+	};
+
+	struct ThreadSlot
+	{
+		std::atomic<unsigned long long> count[kZoneCount];
+		std::atomic<unsigned long long> ticks[kZoneCount];
+		std::atomic<unsigned long long> max_ticks[kZoneCount];
+		std::vector<Event> events; // allocated only while capturing
+		std::atomic<int> event_count;
+		int id;
+		char pad[64]; // keeps neighbouring heap blocks off the last cache line
+	};
+
+	ThreadSlot* slot();
+
+	ThreadSlot* slots_[kMaxThreads]{};
+	std::atomic<int> slot_count_{ 0 };
+	std::mutex register_lock_; // taken once per thread
+
+	std::atomic<bool> trace_request_{ false };
+	std::atomic<bool> tracing_{ false };
+	unsigned long long frame_start_{ 0 };
+
+	// calibration of the TSC against the steady clock
+	unsigned long long tsc_origin_;
+	std::chrono::steady_clock::time_point clock_origin_;
+};
+
+/*! \class ProfileScope
+\brief Records the lifetime of the scope as one measurement of the zone.
+*/
+class ProfileScope
+{
+public:
+	explicit ProfileScope(const ProfileZone zone) : zone_(zone), start_(Profiler::Now()) { }
+	~ProfileScope() { Profiler::Instance().Record(zone_, start_, Profiler::Now()); }
+
+private:
+	ProfileZone zone_;
+	unsigned long long start_;
+};
+
+// Zones are compiled out unless PROFILER is defined
+#ifdef PROFILER
+#define PROFILE_CONCAT_( a, b ) a##b
+#define PROFILE_CONCAT( a, b ) PROFILE_CONCAT_( a, b )
+#define PROFILE_ZONE( zone ) ProfileScope PROFILE_CONCAT( profile_scope_, __LINE__ )( zone )
+#else
+#define PROFILE_ZONE( zone )
+#endif
@@ -0,0 +1,44 @@
+#pragma once
+
+/*! \class PixelRandom
+\brief Small xorshift generator seeded per pixel and pass.
+
+Every pixel starts from its own state, so the random sequence of a pixel does
+not depend on which thread traces it or in what order.
+*/
+class PixelRandom
+{
+public:
+	void Seed(const unsigned long long seed, const int x, const int y, const int pass)
+	{
+		const unsigned long long pixel = (static_cast<unsigned long long>(static_cast<unsigned int>(x)) << 32) | static_cast<unsigned int>(y);
+		state_ = Mix(seed ^ Mix(pixel ^ Mix(static_cast<unsigned long long>(pass) + 1)));
+		if (state_ == 0)
+			state_ = kDefaultState;
+	}
+
+	//! Uniform number from <0, 1).
+	float Uniform()
+	{
+		state_ ^= state_ >> 12;
+		state_ ^= state_ << 25;
+		state_ ^= state_ >> 27;
+		return static_cast<unsigned int>((state_ * 0x2545F4914F6CDD1Dull) >> 40) * (1.0f / 16777216.0f);
+	}
+
+	unsigned long long state() const { return state_; }
+	void set_state(const unsigned long long state) { state_ = state != 0 ? state : kDefaultState; }
+
+private:
+	static const unsigned long long kDefaultState = 0x9E3779B97F4A7C15ull;
+
+	// splitmix64 finalizer
+	static unsigned long long Mix(unsigned long long z)
+	{
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+
+	unsigned long long state_{ kDefaultState };
+};
@@ -0,0 +1,151 @@
+#include "stdafx.h"
+#include "raystats.h"
+
+static std::atomic<unsigned long long> next_id{ 1 };
+
+RayStats::RayStats() : id_(next_id.fetch_add(1, std::memory_order_relaxed))
+{
+	frame_start_ = std::chrono::steady_clock::now();
+}
+
+RayStats::~RayStats()
+{
+	if (log_file_ != nullptr)
+		fclose(log_file_);
+
+	for (auto& slot : slots_)
+		delete slot.second;
+}
+
+RayStats::Slot* RayStats::slot()
+{
+	// the cache is keyed by the instance id, not the address, slots of a destroyed instance are never reused
+	thread_local unsigned long long owner = 0;
+	thread_local Slot* slot = nullptr;
+	if (owner == id_)
+		return slot;
+
+	// a thread alternating between instances finds its slot again, every slot has exactly one writer
+	std::lock_guard<std::mutex> lock(register_lock_);
+	const std::thread::id thread = std::this_thread::get_id();
+	slot = nullptr;
+	for (const auto& registered : slots_)
+		if (registered.first == thread)
+		{
+			slot = registered.second;
+			break;
+		}
+
+	if (slot == nullptr)
+	{
+		slot = new Slot();
+		memset(slot, 0, sizeof(Slot));
+		slots_.emplace_back(thread, slot);
+	}
+	owner = id_;
+	return slot;
+}
+
+void RayStats::FrameBoundary()
+{
+	const auto now = std::chrono::steady_clock::now();
+
+	Frame frame{};
+	frame.index = frames_++;
+	frame.seconds = std::chrono::duration<double>(now - frame_start_).count();
+	frame_start_ = now;
+
+	{
+		// slots_ grows when a new thread registers
+		std::lock_guard<std::mutex> lock(register_lock_);
+		for (const auto& registered : slots_)
+		{
+			Slot* s = registered.second;
+			for (int type = 0; type < kRayTypeCount; ++type)
+				for (int depth = 0; depth <= kMaxDepth; ++depth)
+				{
+					frame.rays[type] += s->rays[type][depth];
+					frame.depth[depth] += s->rays[type][depth];
+					frame.total += s->rays[type][depth];
+				}
+			frame.environment_misses += s->misses;
+			memset(s, 0, sizeof(Slot));
+		}
+	}
+
+	total_ += frame.total;
+
+	// passes that did not trace anything
+	if (frame.total == 0)
+		return;
+
+	frame.mrays_per_second = frame.seconds > 0 ? frame.total / frame.seconds * 1e-6 : 0.0;
+	if (frame.rays[kRayCamera] > 0)
+		frame.mean_path_length = static_cast<double>(frame.total - frame.rays[kRayShadow]) / frame.rays[kRayCamera];
+
+	{
+		std::lock_guard<std::mutex> lock(last_lock_);
+		last_ = frame;
+	}
+
+	if (log_)
+		WriteLog(frame);
+}
+
+void RayStats::WriteLog(const Frame& frame)
+{
+	if (log_file_ == nullptr)
+	{
+		log_file_ = fopen("ray_stats.jsonl", "w");
+		if (log_file_ == nullptr)
+		{
+			printf("Unable to open ray_stats.jsonl, ray log disabled\n");
+			log_ = false;
+			return;
+		}
+	}
+
+	// one JSON object per line and pass
+	fprintf(log_file_, "{\"frame\":%d,\"seconds\":%.6f,\"rays\":%llu,\"mrays_per_second\":%.3f,\"mean_path_length\":%.4f,\"environment_misses\":%llu",
+		frame.index, frame.seconds, frame.total, frame.mrays_per_second, frame.mean_path_length, frame.environment_misses);
+	for (int type = 0; type < kRayTypeCount; ++type)
+		fprintf(log_file_, ",\"%s\":%llu", name(static_cast<RayType>(type)), frame.rays[type]);
+	fprintf(log_file_, ",\"depth\":[");
+	for (int depth = 0; depth <= kMaxDepth; ++depth)
+		fprintf(log_file_, depth == 0 ? "%llu" : ",%llu", frame.depth[depth]);
+	fprintf(log_file_, "]}\n");
+	fflush(log_file_);
+}
+
+RayStats::Frame RayStats::last_frame() const
+{
+	std::lock_guard<std::mutex> lock(last_lock_);
+	return last_;
+}
+
+const char* RayStats::name(const RayType type)
+{
+	static const char* names[kRayTypeCount] = { "camera", "shadow", "reflection", "refraction", "diffuse" };
+	return names[type];
+}
+
+void RayStats::Ui()
+{
+	const Frame frame = last_frame();
+
+	ImGui::Text("Rays = %.2f Mrays/s (%llu in %.2f s)", frame.mrays_per_second, frame.total, frame.seconds);
+	ImGui::Text("Mean path length = %.2f", frame.mean_path_length);
+	ImGui::SameLine(); ImGui::Text("Environment misses = %llu", frame.environment_misses);
+	for (int type = 0; type < kRayTypeCount; ++type)
+	{
+		if (type % 3 != 0)
+			ImGui::SameLine();
+		ImGui::Text("%s = %llu", name(static_cast<RayType>(type)), frame.rays[type]);
+	}
+
+	float histogram[kMaxDepth + 1];
+	for (int depth = 0; depth <= kMaxDepth; ++depth)
+		histogram[depth] = static_cast<float>(frame.depth[depth]);
+	ImGui::PlotHistogram("Rays by depth", histogram, kMaxDepth + 1, 0, nullptr, 0.0f, FLT_MAX, ImVec2(0, 60));
+	ImGui::Checkbox("Ray log (ray_stats.jsonl)", &log_);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+/*! \enum RayType
+\brief Purpose of a traced ray.
+*/
+enum RayType
+{
+	kRayCamera,
+	kRayShadow,
+	kRayReflection,
+	kRayRefraction,
+	kRayDiffuse, // path tracing bounce
+	kRayTypeCount
+};
+
+/*! \class RayStats
+\brief Per-thread ray counters aggregated once per pass.
+
+Every thread increments plain counters in its own slot, one slot per instance
+and thread. The slots are summed and cleared by FrameBoundary, which is called
+between passes when no worker thread traces, so the hot path needs neither
+locks nor atomics.
+*/
+class RayStats
+{
+public:
+	static const int kMaxDepth = 16; // deeper rays share the last bin
+
+	struct Frame
+	{
+		int index;
+		double seconds;
+		unsigned long long rays[kRayTypeCount];
+		unsigned long long environment_misses; // non-shadow rays leaving the scene
+		unsigned long long depth[kMaxDepth + 1];
+		unsigned long long total;
+		double mrays_per_second;
+		double mean_path_length; // non-shadow segments per camera ray
+	};
+
+	RayStats();
+	~RayStats();
+
+	//! Counts one ray, \a hit tells whether it intersected the scene.
+	void Count(const RayType type, const int depth, const bool hit)
+	{
+		Slot* s = slot();
+		s->rays[type][depth < kMaxDepth ? depth : kMaxDepth]++;
+		if (!hit && type != kRayShadow)
+			s->misses++;
+		s->total++;
+	}
+
+	//! Rays traced by the calling thread in this pass, differences give per pixel counts.
+	unsigned long long thread_rays() { return slot()->total; }
+	//! Rays of one type traced by the calling thread in this pass.
+	unsigned long long thread_rays(const RayType type)
+	{
+		const Slot* s = slot();
+		unsigned long long rays = 0;
+		for (int depth = 0; depth <= kMaxDepth; ++depth)
+			rays += s->rays[type][depth];
+		return rays;
+	}
+
+	//! Aggregates the finished pass and appends it to the log.
+	void FrameBoundary();
+
+	Frame last_frame() const;
+	//! Rays of all aggregated passes.
+	unsigned long long total() const { return total_; }
+	static const char* name(const RayType type);
+
+	void Ui();
+
+	bool log_{ true };
+
+private:
+	struct Slot
+	{
+		unsigned long long rays[kRayTypeCount][kMaxDepth + 1];
+		unsigned long long misses;
+		unsigned long long total;
+		char pad[64]; // keeps neighbouring slots off the last cache line
+	};
+
+	Slot* slot();
+	void WriteLog(const Frame& frame);
+
+	// unique per instance, a new instance may reuse the address of a destroyed one
+	const unsigned long long id_;
+	std::vector<std::pair<std::thread::id, Slot*>> slots_;
+	std::mutex register_lock_; // taken when a thread switches instances
+
+	Frame last_{};
+	mutable std::mutex last_lock_;
+	int frames_{ 0 };
+	unsigned long long total_{ 0 };
+	std::chrono::steady_clock::time_point frame_start_;
+	FILE* log_file_{ nullptr };
+};
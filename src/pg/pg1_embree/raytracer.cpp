@@ -9,32 +9,78 @@
 #include <float.h>
 #include "RTCRayHitModel.h"
 #include "mymath.h"
-
-chrono::time_point<chrono::steady_clock> Raytracer::begin()
+#include "profiler.h"
+#include "raystats.h"
+#include "random.h"
+#include "perfcounters.h"
+
+// generator of the pixel traced by the calling thread
+static thread_local PixelRandom pixel_random;
+// shutter position of the pixel traced by the calling thread, used as the time of all its rays
+static thread_local float pixel_time = 0.0f;
+// geomID hit by the primary ray of the last ray tree traced by the calling thread
+static thread_local unsigned int pixel_geometry = RTC_INVALID_GEOMETRY_ID;
+
+namespace
 {
-	return chrono::high_resolution_clock::now();
+	// reflected or refracted ray waiting for its turn in the Whitted tracer
+	struct PendingRay
+	{
+		RTCRayHit ray_hit; // intersected when cast is set, otherwise only the origin and direction are valid
+		Vector3 weight; // contribution of the ray to the pixel per channel
+		float throughput; // weight compared against the prune threshold
+		float n1; // index of refraction the ray travels in
+		int bump; // of the hit the ray starts at
+		RayType type;
+		bool cast;
+	};
+
+	// pending rays of the calling thread, depth first so it holds about one ray per bounce
+	struct RayStack
+	{
+		static const int kCapacity = 64;
+		PendingRay rays[kCapacity];
+		int size{ 0 };
+	};
 }
 
-void Raytracer::log(chrono::time_point<chrono::steady_clock>& begin, string prefix)
+static thread_local RayStack ray_stack;
+
+static void PushRay(const Vector3& origin, const Vector3& direction, const RayType type, const int bump, const float n1,
+	const Vector3& weight, const float throughput)
 {
-	if (debug_)
-#pragma omp atomic
-		times[prefix] += std::chrono::duration_cast<std::chrono::milliseconds>(chrono::high_resolution_clock::now() - begin).count();
+	PendingRay& ray = ray_stack.rays[ray_stack.size++];
+	ray.ray_hit.ray.org_x = origin.x;
+	ray.ray_hit.ray.org_y = origin.y;
+	ray.ray_hit.ray.org_z = origin.z;
+	ray.ray_hit.ray.dir_x = direction.x;
+	ray.ray_hit.ray.dir_y = direction.y;
+	ray.ray_hit.ray.dir_z = direction.z;
+	ray.weight = weight;
+	ray.throughput = throughput;
+	ray.n1 = n1;
+	ray.bump = bump;
+	ray.type = type;
+	ray.cast = false;
 }
 
-void Raytracer::log(chrono::time_point<chrono::steady_clock>& begin, string prefix, int bump)
+static void PushHit(const RTCRayHit& ray_hit, const int bump, const float n1, const Vector3& weight, const float throughput)
 {
-	if (debug_)
-#pragma omp atomic
-		times[prefix.append(" " + std::to_string(bump))] += std::chrono::duration_cast<std::chrono::milliseconds>(chrono::high_resolution_clock::now() - begin).count();
+	PendingRay& ray = ray_stack.rays[ray_stack.size++];
+	ray.ray_hit = ray_hit;
+	ray.weight = weight;
+	ray.throughput = throughput;
+	ray.n1 = n1;
+	ray.bump = bump;
+	ray.type = kRayRefraction;
+	ray.cast = true;
 }
 
-
 Raytracer::Raytracer(const int width, const int height,
 	const float fov_y, const Vector3 view_from, const Vector3 view_at,
 	Vector3* light, Vector3* lightPower,
 	const Vector3* background,
-	const char* config) : SimpleGuiDX11(width, height)
+	const char* config, const bool headless) : SimpleGuiDX11(width, height, headless)
 {
 	InitDeviceAndScene(config);
 
@@ -56,18 +102,9 @@ Raytracer::Raytracer(const int width, const int height,
 	light_ = *light;
 	lightPower_ = *lightPower;
 
-	ss_e2_ = std::mt19937(random_device{}());
-	ss_dist_ = std::uniform_real_distribution<float>(-SS_D, SS_D);
+	seed_ = random_device{}();
 
-	e2_ = std::mt19937(random_device{}());
-	dist_ = std::uniform_real_distribution<float> (0.f, 1.f);
-
-	times["get_pixel"] = 0;
-	for (int i = 0; i < 11; i++)
-	{
-		times["reflection " + std::to_string(i)] = 0;
-		times["refraction " + std::to_string(i)] = 0;
-	}
+	begin_frame();
 }
 
 Raytracer::~Raytracer()
@@ -105,32 +142,47 @@ int Raytracer::ReleaseDeviceAndScene()
 
 void Raytracer::LoadScene(const std::string file_name)
 {
-	const int no_surfaces = LoadOBJ(file_name.c_str(), surfaces_, materials_);
+	const auto load_start = std::chrono::steady_clock::now();
+	std::vector<std::string> material_libraries;
+	const int no_surfaces = LoadOBJ(file_name.c_str(), surfaces_, materials_, false, Vector3(0.5f, 0.5f, 0.5f), &material_libraries, &scene_arena_);
+	std::vector<std::string> geometry_materials;
+	scene_file_ += file_name + ";";
+	material_table_.Build(materials_);
+
+	// keyframes of scene.obj are stored in scene.anim
+	const std::string animation_file = file_name.substr(0, file_name.find_last_of('.')) + ".anim";
+	if (animation_.Load(animation_file))
+		rtcSetSceneFlags(scene_, RTC_SCENE_FLAG_DYNAMIC);
+	scene_inputs_.push_back(file_name);
+	scene_inputs_.push_back(animation_file);
+	scene_inputs_.insert(scene_inputs_.end(), material_libraries.begin(), material_libraries.end());
+	applied_time_ = -1.0f;
 
 	// surfaces loop
 	for (auto surface : surfaces_)
 	{
 		RTCGeometry mesh = rtcNewGeometry(device_, RTC_GEOMETRY_TYPE_TRIANGLE);
 
+		// animated objects are refit instead of rebuilt, every time step has its own vertex buffer
+		const std::vector<Keyframe>* keys = animation_.track(surface->get_name());
+		const int time_steps = keys != nullptr ? max(motion_steps_, 1) : 1;
+		if (keys != nullptr)
+		{
+			rtcSetGeometryTimeStepCount(mesh, time_steps);
+			rtcSetGeometryBuildQuality(mesh, RTC_BUILD_QUALITY_REFIT);
+		}
+
 		Vertex3f* vertices = (Vertex3f*)rtcSetNewGeometryBuffer(
 			mesh, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3,
 			sizeof(Vertex3f), 3 * surface->no_triangles());
+		for (int step = 1; step < time_steps; ++step)
+			rtcSetNewGeometryBuffer(mesh, RTC_BUFFER_TYPE_VERTEX, step, RTC_FORMAT_FLOAT3,
+				sizeof(Vertex3f), 3 * surface->no_triangles());
 
 		Triangle3ui* triangles = (Triangle3ui*)rtcSetNewGeometryBuffer(
 			mesh, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3,
 			sizeof(Triangle3ui), surface->no_triangles());
 
-		rtcSetGeometryUserData(mesh, (void*)(surface->get_material()));
-
-		rtcSetGeometryVertexAttributeCount(mesh, 2);
-
-		Normal3f* normals = (Normal3f*)rtcSetNewGeometryBuffer(
-			mesh, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0, RTC_FORMAT_FLOAT3,
-			sizeof(Normal3f), 3 * surface->no_triangles());
-
-		Coord2f* tex_coords = (Coord2f*)rtcSetNewGeometryBuffer(
-			mesh, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 1, RTC_FORMAT_FLOAT2,
-			sizeof(Coord2f), 3 * surface->no_triangles());
 
 		// triangles loop
 		for (int i = 0, k = 0; i < surface->no_triangles(); ++i)
@@ -145,13 +197,6 @@ void Raytracer::LoadScene(const std::string file_name)
 				vertices[k].x = vertex.position.x;
 				vertices[k].y = vertex.position.y;
 				vertices[k].z = vertex.position.z;
-
-				normals[k].x = vertex.normal.x;
-				normals[k].y = vertex.normal.y;
-				normals[k].z = vertex.normal.z;
-
-				tex_coords[k].u = vertex.texture_coords[0].u;
-				tex_coords[k].v = vertex.texture_coords[0].v;
 			} // end of vertices loop
 
 			triangles[i].v0 = k - 3;
@@ -159,19 +204,153 @@ void Raytracer::LoadScene(const std::string file_name)
 			triangles[i].v2 = k - 1;
 		} // end of triangles loop
 
+		if (keys != nullptr)
+		{
+			Vector3 lower(FLT_MAX, FLT_MAX, FLT_MAX), upper(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			for (int k = 0; k < 3 * surface->no_triangles(); ++k)
+			{
+				lower = Vector3(min(lower.x, vertices[k].x), min(lower.y, vertices[k].y), min(lower.z, vertices[k].z));
+				upper = Vector3(max(upper.x, vertices[k].x), max(upper.y, vertices[k].y), max(upper.z, vertices[k].z));
+			}
+			animated_.push_back(AnimatedGeometry{ 0, surface, keys, (lower + upper) * 0.5f });
+
+			// the other time steps start in rest pose too
+			for (int step = 1; step < time_steps; ++step)
+				memcpy(rtcGetGeometryBufferData(mesh, RTC_BUFFER_TYPE_VERTEX, step), vertices,
+					sizeof(Vertex3f) * 3 * surface->no_triangles());
+		}
+
 		rtcCommitGeometry(mesh);
 		unsigned int geom_id = rtcAttachGeometry(scene_, mesh);
 		rtcReleaseGeometry(mesh);
+		if (keys != nullptr)
+			animated_.back().geom_id = geom_id;
+
+		if (geometry_materials.size() <= geom_id)
+			geometry_materials.resize(geom_id + 1);
+		geometry_materials[geom_id] = surface->get_material() != nullptr ? surface->get_material()->get_name() : "";
+
+		// normals and texture coordinates are interpolated by us, not by Embree
+		attributes_.Add(geom_id, *surface);
+		material_table_.AddGeometry(geom_id, surface->get_material());
 	} // end of surfaces loop
 
+	std::vector<std::string> textures;
+	for (const Texture* texture : material_table_.textures)
+		textures.push_back(texture->file_name());
+	scene_inputs_.insert(scene_inputs_.end(), textures.begin(), textures.end());
+
+	// materials are reloaded in the background when their files change, not needed without a window
+	if (!headless_)
+		material_watcher_.Watch(material_libraries, textures, geometry_materials);
+
+	const auto build_start = std::chrono::steady_clock::now();
+	rtcCommitScene(scene_);
+	const auto build_end = std::chrono::steady_clock::now();
+	load_seconds_ = std::chrono::duration<double>(build_start - load_start).count();
+	build_seconds_ = std::chrono::duration<double>(build_end - build_start).count();
+}
+
+void Raytracer::UnloadScene()
+{
+	rtcReleaseScene(scene_);
+	scene_ = rtcNewScene(device_);
+	animation_.Clear();
+	animated_.clear();
+
+	material_watcher_.Stop();
+	surfaces_.clear();
+	scene_arena_.Release();
+	ReleaseMaterials(materials_);
+	material_table_.Clear();
+	attributes_.Clear();
+	scene_file_.clear();
+	scene_inputs_.clear();
+}
+
+void Raytracer::SetView(const float fov_y, const Vector3 view_from, const Vector3 view_at, const Vector3 light, const Vector3 light_power)
+{
+	camera_ = Camera(width(), height(), fov_y, view_from, view_at);
+	light_ = light;
+	lightPower_ = light_power;
+}
+
+void Raytracer::ResetSequence(const unsigned int seed)
+{
+	seed_ = seed;
+	frame_ = 0;
+}
+
+const std::string& Raytracer::scene_file() const
+{
+	return scene_file_;
+}
+
+const Animation& Raytracer::animation() const
+{
+	return animation_;
+}
+
+void Raytracer::SetAnimationTime(const float time)
+{
+	for (const AnimatedGeometry& object : animated_)
+	{
+		RTCGeometry mesh = rtcGetGeometry(scene_, object.geom_id);
+		const int steps = max(motion_steps_, 1);
+
+		for (int step = 0; step < steps; ++step)
+		{
+			// time steps are spread evenly over the open shutter
+			const float step_time = time + (steps > 1 ? shutter_ * step / (steps - 1) : 0.0f);
+			Matrix3x3 rotation;
+			Vector3 translation;
+			float scale;
+			Animation::Evaluate(*object.keys, step_time, rotation, translation, scale);
+
+			Vertex3f* vertices = (Vertex3f*)rtcGetGeometryBufferData(mesh, RTC_BUFFER_TYPE_VERTEX, step);
+			for (int i = 0, k = 0; i < object.surface->no_triangles(); ++i)
+				for (int j = 0; j < 3; ++j, ++k)
+				{
+					const Vector3& position = object.surface->get_triangle(i).vertex(j).position;
+					const Vector3 p = rotation * ((position - object.pivot) * scale) + object.pivot + translation;
+					vertices[k] = Vertex3f{ p.x, p.y, p.z };
+				}
+			rtcUpdateGeometryBuffer(mesh, RTC_BUFFER_TYPE_VERTEX, step);
+		}
+
+		// shading normals follow the orientation in the middle of the shutter
+		Matrix3x3 rotation;
+		Vector3 translation;
+		float scale;
+		Animation::Evaluate(*object.keys, time + (steps > 1 ? shutter_ * 0.5f : 0.0f), rotation, translation, scale);
+		attributes_.SetNormalTransform(object.geom_id, rotation);
+
+		rtcCommitGeometry(mesh);
+	}
+
+	const auto refit_start = std::chrono::steady_clock::now();
 	rtcCommitScene(scene_);
+	build_seconds_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - refit_start).count();
+
+	applied_time_ = time;
+	applied_shutter_ = shutter_;
 }
 
+float Raytracer::shutter_time(const int x, const int y) const
+{
+	if (motion_steps_ < 2 || animated_.empty())
+		return 0.0f;
+
+	// independent of the pixel generator, primary rays of a row are cast before it is seeded
+	PixelRandom random;
+	random.Seed(seed_ ^ 0x5BD1E995u, x, y, frame_);
+	return random.Uniform();
+}
 
 RTCRayHit Raytracer::prepare_ray_hit(const float t, RTCRay ray, const float& tnear)
 {
 	ray.tnear = tnear;// FLT_MIN; // start of ray segment
-	ray.time = t; // time of this ray for motion blur
+	ray.time = pixel_time; // shutter position of this ray for motion blur, Embree expects <0, 1>
 
 	ray.tfar = FLT_MAX; // end of ray segment (set to hit distance)
 
@@ -190,42 +369,46 @@ RTCRayHit Raytracer::prepare_ray_hit(const float t, RTCRay ray, const float& tne
 	return ray_hit;
 }
 
+template <class K>
 Vector3 Raytracer::get_material_color(RTCRayHitModel& hit, const float& t, int bump)
 {
-	if (path_)
-		return get_material_shader_color(hit, t) + path_trace(hit, t, 0);
+	if (K::path != PathOff)
+		return get_material_shader_color<K>(hit, t, bump) + path_trace<K>(hit, t, 0);
 	else
-		return get_material_shader_color(hit, t);
+		return get_material_shader_color<K>(hit, t, bump);
 }
 
-bool Raytracer::check_shadow(RTCRayHitModel& hit, const float& t, const Vector3& lightVector)
+template <class K>
+bool Raytracer::check_shadow(RTCRayHitModel& hit, const float& t, const Vector3& lightVector, const int bump)
 {
+	PERF_DETAIL_STAGE(kStageShadow, &ray_stats_);
+
 	// Check Shadow
 	// Only if is above normal
-	Vector3 shadow = (!hit.material->isTransparent() && hit.normal.DotProduct(lightVector) < 0 ? Vector3{ 0,0,0 } : Vector3{ 1,1,1 });
-	if (shadows_ && shadow.Lg(0.f))
+	Vector3 shadow = (!hit.is_transparent() && hit.normal.DotProduct(lightVector) < 0 ? Vector3{ 0,0,0 } : Vector3{ 1,1,1 });
+	if (K::shadows && shadow.Lg(0.f))
 	{
-		auto ray = cast_ray(hit.hit, light_, t);
+		auto ray = cast_ray(hit.hit, light_, t, kRayShadow, bump);
 		if (has_colision(ray))
 		{
-			auto data = build_ray_model(ray, hit.material->ior);
-			if(data.material->isTransparent())
-				shadow -= data.material->attenuation.Exp(data.n1 == IOR_AIR ? 0 : -data.core.ray.tfar);
+			auto data = build_ray_model(ray, hit.ior());
+			if(data.is_transparent())
+				shadow -= data.attenuation().Exp(data.n1 == IOR_AIR ? 0 : -data.core.ray.tfar);
 
-			while (!data.material->isTransparent() && shadow.Lg(0.f))
+			while (!data.is_transparent() && shadow.Lg(0.f))
 			{
-				ray = cast_ray(hit.hit, light_, t, data.core.ray.tfar + 0.1f);
+				ray = cast_ray(hit.hit, light_, t, kRayShadow, bump, data.core.ray.tfar + 0.1f);
 				if (has_colision(ray))
 				{
-					data = build_ray_model(ray, hit.material->ior);
-					if (data.material->isTransparent())
-						shadow -= data.material->attenuation.Exp(data.n1 == IOR_AIR ? 0 : -data.core.ray.tfar);
+					data = build_ray_model(ray, hit.ior());
+					if (data.is_transparent())
+						shadow -= data.attenuation().Exp(data.n1 == IOR_AIR ? 0 : -data.core.ray.tfar);
 				}
 				else
 					break;
 			}
 
-			if (!data.material->isTransparent() || !shadow.Lg(0.f))
+			if (!data.is_transparent() || !shadow.Lg(0.f))
 				shadow = { 0,0,0 };
 		}
 	}
@@ -233,31 +416,34 @@ bool Raytracer::check_shadow(RTCRayHitModel& hit, const float& t, const Vector3&
 	return !shadow.Lg(0.f);
 }
 
-Vector3 Raytracer::shader_normal(RTCRayHitModel& hit, const float& t)
+template <class K>
+Vector3 Raytracer::shader_normal(RTCRayHitModel& hit, const float& t, const int bump)
 {
 	return hit.normal * 0.5 + 0.5;
 }
 
-Vector3 Raytracer::shader_lambert(RTCRayHitModel& hit, const float& t)
+template <class K>
+Vector3 Raytracer::shader_lambert(RTCRayHitModel& hit, const float& t, const int bump)
 {
 	Vector3 light = light_;
 	light.Normalize();
 
-	if (check_shadow(hit, t, light))
+	if (check_shadow<K>(hit, t, light, bump))
 		return Color_Empty;
 
 	return 
 		lightPower_.y * hit.colorDiffuse * hit.normal.DotProduct(light) +
-		hit.material->emission;
+		hit.emission();
 }
 
-Vector3 Raytracer::shader_phong(RTCRayHitModel& hit, const float& t)
+template <class K>
+Vector3 Raytracer::shader_phong(RTCRayHitModel& hit, const float& t, const int bump)
 {
 	// Compute vectors
 	Vector3 light = light_;
 	light.Normalize();
 
-	if (check_shadow(hit, t, light))
+	if (check_shadow<K>(hit, t, light, bump))
 		return Color_Empty;
 
 	Vector3 reflected = light.Reflect(hit.normal);
@@ -268,27 +454,29 @@ Vector3 Raytracer::shader_phong(RTCRayHitModel& hit, const float& t)
 	Vector3 power = lightPower_;
 
 	return 
-		power.x * hit.material->ambient +
+		power.x * hit.ambient() +
 		power.y * hit.colorDiffuse * max(hit.normal.DotProduct(light), 0.f) +
-		power.z * hit.material->specular * powf(max(reflected.DotProduct(cam), 0.f), hit.material->shininess) +
-		hit.material->emission;
+		power.z * hit.colorSpecular * powf(max(reflected.DotProduct(cam), 0.f), hit.shininess()) +
+		hit.emission();
 }
 
-Vector3 Raytracer::shader_shadow(RTCRayHitModel& hit, const float& t)
+template <class K>
+Vector3 Raytracer::shader_shadow(RTCRayHitModel& hit, const float& t, const int bump)
 {
 	Vector3 light = light_;
 	light.Normalize();
 
-	return check_shadow(hit, t, light) ? Vector3{ 1, 0, 0 } : Color_Empty;
+	return check_shadow<K>(hit, t, light, bump) ? Vector3{ 1, 0, 0 } : Color_Empty;
 }
 
-Vector3 Raytracer::shader_light(RTCRayHitModel& hit, const float& t)
+template <class K>
+Vector3 Raytracer::shader_light(RTCRayHitModel& hit, const float& t, const int bump)
 {
 	// Compute vectors
 	Vector3 light = light_;
 	light.Normalize();
 
-	if (check_shadow(hit, t, light))
+	if (check_shadow<K>(hit, t, light, bump))
 		return Color_Empty;
 
 	Vector3 reflected = light.Reflect(hit.normal);
@@ -300,35 +488,34 @@ Vector3 Raytracer::shader_light(RTCRayHitModel& hit, const float& t)
 
 	return 
 		power.y * max(hit.normal.DotProduct(light), 0.f) * Vector3 { 1, 1, 1 }  +
-		power.z * powf(max(reflected.DotProduct(cam), 0.f), hit.material->shininess) * Vector3 { 1, 1, 1 } +
-		hit.material->emission;
+		power.z * powf(max(reflected.DotProduct(cam), 0.f), hit.shininess()) * Vector3 { 1, 1, 1 } +
+		hit.emission();
 }
 
+template <class K>
 Vector3 Raytracer::get_material_shader_color(RTCRayHitModel& hit, const float& t, int bump)
 {
 	Vector3 color = Color_Empty;
 
-	if (hit.material != nullptr)
-		switch (shaderSelected)
+	if (hit.material >= 0)
+		switch (K::shader)
 		{
 		case 0:
-			color = shader_normal(hit, t);
+			color = shader_normal<K>(hit, t, bump);
 			break;
 		case 1:
-			color = shader_light(hit, t);
+			color = shader_light<K>(hit, t, bump);
 			break;
 		case 2:
-			color = shader_shadow(hit, t);
+			color = shader_shadow<K>(hit, t, bump);
 			break;
 		case 3:
-			color = shader_lambert(hit, t);
+			color = shader_lambert<K>(hit, t, bump);
 			break;
 		case 4:
-			color = shader_phong(hit, t);
+			color = shader_phong<K>(hit, t, bump);
 			break;
 		}
-	/*auto s = shaders[shaderSelected];
-	color = s(hit, t);*/
 
 	return SrgbTransform::srgbToLinear(color);
 }
@@ -340,7 +527,7 @@ Matrix3x3 createCoordinateSystem(Vector3 N)
 	return { o2, o1, N };
 }
 
-Sample Raytracer::sample_hemisphere(RTCRayHitModel& hit, const float& t, Matrix3x3& world, SampleMode mode)
+Sample Raytracer::sample_hemisphere(RTCRayHitModel& hit, const float& t, Matrix3x3& world, SampleMode mode, const int depth)
 {
 	Sample sample = Sample();
 
@@ -355,7 +542,7 @@ Sample Raytracer::sample_hemisphere(RTCRayHitModel& hit, const float& t, Matrix3
 		sinTheta = sqrtf(1 - rv);
 		break;
 	case CosLobe:
-		sinTheta = sqrtf(1 - powf(rv, 2.f / (hit.material->shininess + 1)));
+		sinTheta = sqrtf(1 - powf(rv, 2.f / (hit.shininess() + 1)));
 		break;
 	}
 
@@ -363,7 +550,7 @@ Sample Raytracer::sample_hemisphere(RTCRayHitModel& hit, const float& t, Matrix3
 	float y = sinTheta * sinf(phi);
 
 	sample.Dir = world * Vector3(x, y, sqrtf(rv));
-	prepare_sample(hit, t, sample, mode);
+	prepare_sample(hit, t, sample, mode, kRayDiffuse, depth);
 
 	switch (mode)
 	{
@@ -371,7 +558,7 @@ Sample Raytracer::sample_hemisphere(RTCRayHitModel& hit, const float& t, Matrix3
 		sample.PDF = sample.OmegaIN * M_1_PI;
 		break;
 	case CosLobe:
-		sample.PDF = ((hit.material->shininess + 2.f) * powf(sample.Dir.DotProduct(sample.OmegaR), hit.material->shininess)) * M_1_2PI;
+		sample.PDF = ((hit.shininess() + 2.f) * powf(sample.Dir.DotProduct(sample.OmegaR), hit.shininess())) * M_1_2PI;
 		break;
 	}
 	
@@ -379,7 +566,7 @@ Sample Raytracer::sample_hemisphere(RTCRayHitModel& hit, const float& t, Matrix3
 	return sample;
 }
 
-Sample Raytracer::prepare_sample(RTCRayHitModel& hit, const float& t, Sample& sample, SampleMode mode)
+Sample Raytracer::prepare_sample(RTCRayHitModel& hit, const float& t, Sample& sample, SampleMode mode, const RayType type, const int depth)
 {
 	switch (mode)
 	{
@@ -396,41 +583,45 @@ Sample Raytracer::prepare_sample(RTCRayHitModel& hit, const float& t, Sample& sa
 		sample.Dir = -sample.Dir;
 		sample.OmegaIN = -sample.OmegaIN;
 	}
-	sample.Ray = cast_ray(hit.hit, sample.Dir, t);
+	sample.Ray = cast_ray(hit.hit, sample.Dir, t, type, depth);
 	sample.Colision = has_colision(sample.Ray);
 	return sample;
 }
 
+template <class K>
 Vector3 Raytracer::path_trace(RTCRayHitModel& hit, const float& t, int bump)
 {
+	PERF_DETAIL_STAGE(kStageBounce, &ray_stats_);
+
 	Sample sample;
 	Vector3 fr;
 	float distance = hit.core.ray.tfar;
 
 	// Last
-	if (bump > PATH_MAX_BUMPS || (hit.roulette && get_random_float() >= hit.rouletteRho))
+	const bool roulette = roulette_ && hit.roulette;
+	if (bump > PATH_MAX_BUMPS || (roulette && get_random_float() >= hit.rouletteRho))
 		return Color_Empty;
 		//return hit.colorDiffuse;
 
 	// Emissive
-	Vector3 color = hit.material->emission; 
+	Vector3 color = hit.emission(); 
 	if (color.Lg(0.f))
 		return color;
 
 	// Normal
 	Matrix3x3 world = createCoordinateSystem(hit.normal);
-	int samples = path_deep_ ? PATH_SAMPLES : (PATH_SAMPLES / (bump + 1) + 1);
+	const int samples = path_samples(bump);
 	for (int i = 0, j; i < samples; i++)
 	{
-		if (hit.material->isMirror() || hit.material->isTransparent())
+		if (hit.is_mirror() || hit.is_transparent())
 		{
 			hit.calc_fresnel();
-			if (hit.material->isTransparent())
+			if (hit.is_transparent())
 			{
 				// Transparent object
 				// Refraction
 				sample.Dir = hit.refracted;
-				sample.Ray = cast_ray(hit.hit, sample.Dir, t);
+				sample.Ray = cast_ray(hit.hit, sample.Dir, t, kRayRefraction, bump + 1);
 				sample.Colision = has_colision(sample.Ray);
 
 				if (!sample.Colision)
@@ -442,7 +633,7 @@ Vector3 Raytracer::path_trace(RTCRayHitModel& hit, const float& t, int bump)
 					distance = hit.n1 == IOR_AIR ? 0 : distance;
 					// Recursive tracing
 					sample.Model = build_ray_model(sample.Ray, hit.n2);
-					Vector3 result = path_trace(sample.Model, t, bump + 1);
+					Vector3 result = path_trace<K>(sample.Model, t, bump + 1);
 					hit.colorRefracted = result;
 				}
 			}
@@ -451,7 +642,7 @@ Vector3 Raytracer::path_trace(RTCRayHitModel& hit, const float& t, int bump)
 			
 			// Reflect ray
 			sample.Dir = hit.reflected;
-			prepare_sample(hit, t, sample, CosWeighted);
+			prepare_sample(hit, t, sample, CosWeighted, kRayReflection, bump + 1);
 
 			if (!sample.Colision)
 				hit.colorReflected = cubeMap_->get_texel(sample.Dir);
@@ -459,7 +650,7 @@ Vector3 Raytracer::path_trace(RTCRayHitModel& hit, const float& t, int bump)
 			{
 				// Recursive tracing
 				sample.Model = build_ray_model(sample.Ray, hit.n1);
-				Vector3 result = path_trace(sample.Model, t, bump + 1);
+				Vector3 result = path_trace<K>(sample.Model, t, bump + 1);
 				hit.colorReflected = result;
 			}
 
@@ -469,7 +660,7 @@ Vector3 Raytracer::path_trace(RTCRayHitModel& hit, const float& t, int bump)
 		else
 		{
 			// Lambert
-			sample = sample_hemisphere(hit, t, world, CosWeighted);
+			sample = sample_hemisphere(hit, t, world, CosWeighted, bump + 1);
 
 			fr = hit.colorDiffuse * M_1_PI;
 
@@ -479,7 +670,7 @@ Vector3 Raytracer::path_trace(RTCRayHitModel& hit, const float& t, int bump)
 			{
 				// Recursive tracing
 				sample.Model = build_ray_model(sample.Ray, hit.n1);
-				Vector3 result = path_trace(sample.Model, t, bump + 1);
+				Vector3 result = path_trace<K>(sample.Model, t, bump + 1);
 				hit.colorRefracted = result * fr * sample.OmegaIN * 1.f / sample.PDF;
 			}
 
@@ -487,7 +678,7 @@ Vector3 Raytracer::path_trace(RTCRayHitModel& hit, const float& t, int bump)
 		}
 	}
 
-	if(hit.roulette)
+	if(roulette)
 		return color / (samples * hit.rouletteRho);
 	return color / samples;
 }
@@ -511,12 +702,13 @@ RTCRay Raytracer::generate_ray(const Vector3& hit, const Vector3& direction)
 	return ray;
 }
 
-RTCRayHit Raytracer::cast_ray(const Vector3& position, const Vector3& direction, const float& t, const float& tnear)
+RTCRayHit Raytracer::cast_ray(const Vector3& position, const Vector3& direction, const float& t, const RayType type, const int depth, const float& tnear)
 {
 	RTCRayHit ray_hit = prepare_ray_hit(t, generate_ray(position, direction), tnear);
 	RTCIntersectContext context;
 	rtcInitIntersectContext(&context);
 	rtcIntersect1(scene_, &context, &ray_hit);
+	ray_stats_.Count(type, depth, has_colision(ray_hit));
 	return ray_hit;
 }
 
@@ -526,12 +718,13 @@ RTCRayHit Raytracer::cast_ray(const RTCRay& ray, const float& t)
 	RTCIntersectContext context;
 	rtcInitIntersectContext(&context);
 	rtcIntersect1(scene_, &context, &ray_hit);
+	ray_stats_.Count(kRayCamera, 0, has_colision(ray_hit));
 	return ray_hit;
 }
 
 RTCRayHitModel Raytracer::build_ray_model(const RTCRayHit& hit, const float& ior)
 {
-	return RTCRayHitModel(hit, &scene_, ior);
+	return RTCRayHitModel(hit, &attributes_, &material_table_, ior);
 }
 
 bool Raytracer::has_colision(const RTCRayHit& hit)
@@ -541,18 +734,28 @@ bool Raytracer::has_colision(const RTCRayHit& hit)
 
 bool Raytracer::has_colision(const RTCRayHitModel& hit)
 {
-	return hit.material->shader != 4;
+	return hit.shader() != 4;
 }
 
+template <class K>
 RayCollision Raytracer::get_collision_type(RTCRayHitModel& hit, const int bump)
+{
+	if (ray_map_ && bump == RAY_MAP_BUMP)
+		return RayMap;
+
+	return get_surface_collision<K>(hit, bump);
+}
+
+template <class K>
+RayCollision Raytracer::get_surface_collision(RTCRayHitModel& hit, const int bump)
 {
 	RayCollision collision = Diffuse;
 	if (bump <= RAY_MAX_BUMPS)
 	{
-		if (refl_
-			&& refr_
-			&& hit.material->isReflective()
-			&& hit.material->isTransparent())
+		if (K::refl
+			&& K::refr
+			&& hit.is_reflective()
+			&& hit.is_transparent())
 		{
 			hit.calc_fresnel();
 			if (hit.R == 0)
@@ -562,136 +765,616 @@ RayCollision Raytracer::get_collision_type(RTCRayHitModel& hit, const int bump)
 			else
 				collision = All;
 		}
-		else if (refl_ && hit.material->isReflective())
+		else if (K::refl && hit.is_reflective())
 		{
 			hit.calc_fresnel();
 			collision = Reflection;
 		}
-		else if (refr_ && hit.material->isTransparent())
+		else if (K::refr && hit.is_transparent())
 		{
 			hit.calc_fresnel();
 			collision = Refraction;
 		}
 	}
 
-	if (ray_map_ && bump == RAY_MAP_BUMP)
-		collision = RayMap;
-
 	return collision;
 }
 
-int Raytracer::get_ray_count(RTCRayHit ray_hit, const float& t, float& n1, int bump)
+// largest transmittance of the segment inside a medium that ends at the hit, the weight it leaves to the branches
+float Raytracer::medium_weight(RTCRayHitModel& data)
+{
+	if (data.n1 == IOR_AIR)
+		return 1.0f;
+	return data.attenuation().Exp(-data.core.ray.tfar).LargestValue();
+}
+
+// Russian roulette of branches below prune_threshold_, false when the branch is terminated,
+// the weight of a survivor is scaled up to keep the estimate unbiased
+bool Raytracer::survives(float& throughput, Vector3& weight)
 {
-	int count = 0;
-	if (has_colision(ray_hit))
+	if (!prune_ || throughput >= prune_threshold_)
+		return true;
+	if (get_random_float() * prune_threshold_ >= throughput)
+		return false;
+	weight *= prune_threshold_ / throughput;
+	throughput = prune_threshold_;
+	return true;
+}
+
+// shades the hit and pushes its reflected and refracted rays, returns the contribution of the hit itself
+template <class K>
+Vector3 Raytracer::expand(RTCRayHitModel& data, RayCollision collision, const float& t, int bump, const Vector3& weight)
+{
+	// a full stack ends the tree at any depth, the hit is shaded as diffuse
+	if (collision != RayMap && ray_stack.size + 2 > RayStack::kCapacity)
+		collision = Diffuse;
+
+	switch (collision)
 	{
-		auto data = build_ray_model(ray_hit, n1);
-		bump++;
-		switch (get_collision_type(data, bump))
+	case Diffuse:
+		return get_material_color<K>(data, t, bump) * weight;
+	case RayMap:
+		return shade_ray_map<K>(data, t, bump) * weight;
+	case Reflection:
+		PushRay(data.hit, data.reflected, kRayReflection, bump, data.n1, weight * data.R, data.throughput * data.R);
+		if (data.R != 0)
+			return get_material_color<K>(data, t, bump) * (weight * (1.0f - data.R));
+		return Color_Empty;
+	default:
+		break;
+	}
+
+	// All and Refraction
+	float distance = data.core.ray.tfar;
+	const float throughput = data.throughput * medium_weight(data);
+
+	// one child per node keeps the ray tree linear in depth, the chosen child carries the whole weight
+	bool refract = true, reflect = collision == All;
+	float refracted_scale = 1.0f, reflected_scale = 1.0f;
+	if (collision == All && branch_roulette_)
+	{
+		if (get_random_float() < data.R)
 		{
-		case Diffuse:
-			count++;
-			break;
+			refract = false;
+			reflected_scale = 1.0f / data.R;
+		}
+		else
+		{
+			reflect = false;
+			refracted_scale = 1.0f / (1.0f - data.R);
+		}
+	}
 
-		case RayMap:
-		case All:
-			// Refraction
-			count += get_ray_count(cast_ray(data.hit, data.refracted, t), t, data.n2, bump);
+	// the refracted ray is intersected right away, whether it hits decides the attenuation of the node,
+	// terminated branches count as hits
+	float refracted_throughput = throughput * (1.0f - data.R) * refracted_scale;
+	Vector3 refracted_weight(1, 1, 1);
+	RTCRayHit refracted_hit;
+	bool refracted_traced = false;
+	if (refract)
+	{
+		refracted_traced = survives(refracted_throughput, refracted_weight);
+		if (refracted_traced)
+			refracted_hit = cast_ray(data.hit, data.refracted, t, kRayRefraction, bump);
+		if (!refracted_traced || has_colision(refracted_hit))
+			distance = data.n1 == IOR_AIR ? 0 : distance;
+	}
+	else
+		// the reflected ray alone does not cross the medium behind the surface, as for a pruned refraction
+		distance = data.n1 == IOR_AIR ? 0 : distance;
+	const Vector3 node = weight * data.attenuation().Exp(-distance);
 
-			// Reflection
-			count += get_ray_count(cast_ray(data.hit, data.reflected, t), t, data.n1, bump) + 1;
-			break;
+	// pushed first, so the refracted subtree is traced before it
+	if (reflect)
+		PushRay(data.hit, data.reflected, kRayReflection, bump, data.n1, node * (data.R * reflected_scale), throughput * data.R * reflected_scale);
 
-		case Refraction:
-			count = get_ray_count(cast_ray(data.hit, data.refracted, t), t, data.n2, bump);
-			break;
+	if (!refracted_traced)
+		return Color_Empty;
+	refracted_weight = refracted_weight * node * ((1.0f - data.R) * refracted_scale);
+	if (!has_colision(refracted_hit))
+		return cubeMap_->get_texel(data.refracted) * refracted_weight;
+	PushHit(refracted_hit, bump, data.n2, refracted_weight, refracted_throughput);
+	return Color_Empty;
+}
 
-		case Reflection:
-			count = get_ray_count(cast_ray(data.hit, data.reflected, t), t, data.n1, bump) + 1;
-			break;
+template <class K>
+Vector3 Raytracer::shade_tree(RTCRayHitModel& data, const RayCollision collision, const float& t, int bump)
+{
+	// rays of this tree stay above the rays of an outer one, ray maps shade nested trees
+	const int base = ray_stack.size;
+	Vector3 color = expand<K>(data, collision, t, bump, Vector3(1, 1, 1));
+
+	while (ray_stack.size > base)
+	{
+		PendingRay ray = ray_stack.rays[--ray_stack.size];
+		if (!ray.cast)
+		{
+			// the roulette of a reflected ray runs when its turn comes, in the same order as the recursive tracer
+			if (!survives(ray.throughput, ray.weight))
+				continue;
+			const Vector3 origin(ray.ray_hit.ray.org_x, ray.ray_hit.ray.org_y, ray.ray_hit.ray.org_z);
+			const Vector3 direction(ray.ray_hit.ray.dir_x, ray.ray_hit.ray.dir_y, ray.ray_hit.ray.dir_z);
+			ray.ray_hit = cast_ray(origin, direction, t, ray.type, ray.bump);
+			if (!has_colision(ray.ray_hit))
+			{
+				color += cubeMap_->get_texel(direction) * ray.weight;
+				continue;
+			}
 		}
+
+		auto hit = build_ray_model(ray.ray_hit, ray.n1);
+		hit.throughput = ray.throughput;
+		const int hit_bump = ray.bump + 1;
+		color += expand<K>(hit, get_collision_type<K>(hit, hit_bump), t, hit_bump, ray.weight);
 	}
-	return count;
+
+	return color;
 }
 
-bool Raytracer::ray_trace(RTCRayHit ray_hit, const float& t, Vector3& color, float& n1, int bump, Vector3(Raytracer::* sample_func)(RTCRayHitModel&, const float&, int bump))
+template <class K>
+Vector3 Raytracer::shade_ray_map(RTCRayHitModel& data, const float& t, int bump)
 {
-	// intersected ray with the scene
+	// trace the hit as usual and count the reflected and refracted rays of its tree, shadow and path rays are not part of it
+	const unsigned long long rays = ray_stats_.thread_rays(kRayReflection) + ray_stats_.thread_rays(kRayRefraction);
+	shade<K>(data, get_surface_collision<K>(data, bump), t, bump);
+	const float tree = (float)(ray_stats_.thread_rays(kRayReflection) + ray_stats_.thread_rays(kRayRefraction) - rays) + 1;
+
+	// the largest tree has a node per bump and branch, binary with both reflection and refraction
+	const int branches = K::refl + K::refr;
+	const int levels = max(RAY_MAX_BUMPS - bump + 1, 1);
+	const float largest = branches == 2 ? ldexpf(1.0f, levels) - 1.0f : (branches == 1 ? (float)levels : 1.0f);
+	const float count = tree / largest;
+	// cout, refracted, reflected
+	return { count, data.R, 1.f - data.R };
+}
 
-	if (has_colision(ray_hit))
+template <class K>
+Vector3 Raytracer::shade(RTCRayHitModel& data, const RayCollision collision, const float& t, int bump)
+{
+	switch (collision)
 	{
-		auto data = build_ray_model(ray_hit, n1);
-		bump++;
-		float distance = data.core.ray.tfar;
-		switch (get_collision_type(data, bump))
-		{
-		case Diffuse:
-			color = (*this.*sample_func)(data, t, bump);
-			break;
+	case Diffuse:
+		return get_material_color<K>(data, t, bump);
+	case All:
+	case Refraction:
+	case Reflection:
+		return shade_tree<K>(data, collision, t, bump);
+	case RayMap:
+		return shade_ray_map<K>(data, t, bump);
+	}
+	return Color_Empty;
+}
 
-		case All:
-			// Refraction
-			if (!ray_trace(cast_ray(data.hit, data.refracted, t), t, data.colorRefracted, data.n2, bump, sample_func))
-				data.colorRefracted = cubeMap_->get_texel(data.refracted);
-			else distance = data.n1 == IOR_AIR ? 0 : distance;
+template <class K, RayCollision C>
+void Raytracer::shade_group(const ShadingGroup& group, const float& t, Color4f* result)
+{
+	// the collision type is a template argument, the switch in shade folds away and every group runs a branch free kernel
+	for (int i = group.begin; i < group.end; ++i)
+	{
+		const int x = order_[i];
+		const PixelCost cost = begin_pixel(x, row_);
+		store_color(result[x], shade<K>(hits_[x], C, t, 1));
+		end_pixel(x, row_, cost);
+	}
+}
 
-			// Reflection
-			if (!ray_trace(cast_ray(data.hit, data.reflected, t), t, data.colorReflected, data.n1, bump, sample_func))
-				data.colorReflected = cubeMap_->get_texel(data.reflected);
+void Raytracer::store_color(Color4f& pixel, const Vector3& color)
+{
+	pixel = Color4f{ color.x, color.y, color.z, 1 };
+}
 
-			// Result
-			color = data.calc_result_color(distance);
-			break;
+void Raytracer::sample_row(const int y, const float t, Color4f* result)
+{
+	if (adaptive_ && ss_ != 0)
+	{
+		sample_row_adaptive(y, t, result);
+		return;
+	}
 
-		case Refraction:
-			if (!ray_trace(cast_ray(data.hit, data.refracted, t), t, data.colorRefracted, data.n2, bump, sample_func))
-				data.colorRefracted = cubeMap_->get_texel(data.refracted);
-			else distance = data.n1 == IOR_AIR ? 0 : distance;
-			data.colorReflected = Color_Empty;
-			color = data.calc_result_color(distance);
-			break;
+	// supersampling traces several rays per pixel, keep the per pixel path for it
+	if (!coherent_ || ss_ != 0)
+	{
+		SimpleGuiDX11::sample_row(y, t, result);
+		return;
+	}
 
-		case Reflection:
-			if (!ray_trace(cast_ray(data.hit, data.reflected, t), t, data.colorReflected, data.n1, bump, sample_func))
-				data.colorReflected = cubeMap_->get_texel(data.reflected);
-			if (data.R != 0)
-				data.colorRefracted = (*this.*sample_func)(data, t, bump);
-			else
-				data.colorRefracted = Color_Empty;
-			color = data.calc_result_color(-1);
-			break;
+	const int width = this->width();
+	const int keys = material_table_.size() * kCollisionTypes;
+	row_ = y;
+	rays_.resize(width);
+	normals_.resize(width);
+	tex_coords_.resize(width);
+	hits_.resize(width);
+	keys_.resize(width);
+	order_.resize(width);
+	key_offsets_.assign(keys + 1, 0);
+
+	// Intersect all primary rays of the row
+	{
+		PROFILE_ZONE(kZonePrimary);
+		#pragma omp parallel
+		{
+			PERF_RAY_STAGE(kStagePrimary, &ray_stats_);
+			#pragma omp for
+			for (int x = 0; x < width; ++x)
+			{
+				// the primary ray is part of the pixel cost like in get_pixel, shading adds to it
+				const unsigned long long start = Profiler::Now();
+				pixel_time = shutter_time(x, y);
+				rays_[x] = cast_ray(camera_.GenerateRay(x, y), t);
+				costs_[y * width + x] = static_cast<float>(Profiler::Now() - start);
+				ray_counts_[y * width + x] = 1;
+			}
+		}
+	}
 
-		case RayMap:
-			float count = (float)get_ray_count(ray_hit, t, n1, bump - 1) + 1;
-			count = count / (float)pow(RAY_MAX_BUMPS, 1 + refl_ + refr_);
-			// cout, refracted, reflected
-			color = {count, data.R, 1.f - data.R};
-			break;
+	// Interpolate attributes of the whole batch
+	{
+		PROFILE_ZONE(kZoneInterpolate);
+		#pragma omp parallel for
+		for (int x = 0; x < width; x += kInterpolationBatch)
+			attributes_.Interpolate(&rays_[x], min(kInterpolationBatch, width - x), &normals_[x], &tex_coords_[x]);
+	}
+
+	#pragma omp parallel for
+	for (int x = 0; x < width; ++x)
+	{
+		const RTCRayHit& ray = rays_[x];
+		keys_[x] = -1;
+		if (has_colision(ray))
+		{
+			hits_[x] = RTCRayHitModel(ray, &material_table_, IOR_AIR, normals_[x], tex_coords_[x]);
+			keys_[x] = hits_[x].material * kCollisionTypes + (this->*kernel_.collision)(hits_[x], 1);
 		}
-		return true;
+		else
+			// Background
+			store_color(result[x], cubeMap_->get_texel(Vector3(ray.ray.dir_x, ray.ray.dir_y, ray.ray.dir_z)));
 	}
 
-	return false;
+	// Counting sort of hits by (material, collision type)
+	{
+		PROFILE_ZONE(kZoneSort);
+		for (int x = 0; x < width; ++x)
+			if (keys_[x] >= 0)
+				key_offsets_[keys_[x] + 1]++;
+		for (int k = 0; k < keys; ++k)
+			key_offsets_[k + 1] += key_offsets_[k];
+		groups_.clear();
+		for (int k = 0; k < keys; ++k)
+			for (int begin = key_offsets_[k]; begin < key_offsets_[k + 1]; begin += kShadingGroupSize)
+				groups_.push_back({ begin, min(begin + kShadingGroupSize, key_offsets_[k + 1]), (RayCollision)(k % kCollisionTypes) });
+		for (int x = 0; x < width; ++x)
+			if (keys_[x] >= 0)
+				order_[key_offsets_[keys_[x]]++] = x;
+	}
+
+	// Shade groups, neighbouring threads run the same kernel on the same material
+	const int no_groups = (int)groups_.size();
+	#pragma omp parallel
+	{
+		PROFILE_ZONE(kZoneShade);
+		PERF_RAY_STAGE(kStageShading, &ray_stats_);
+		#pragma omp for schedule(dynamic)
+		for (int g = 0; g < no_groups; ++g)
+		{
+			// groups hold at most kShadingGroupSize pixels, a restart abandons the rest of the row
+			if (restart_pending())
+				continue;
+			(this->*kernel_.shade_group[groups_[g].collision])(groups_[g], t, result);
+		}
+	}
 }
 
-Vector3 Raytracer::get_pixel_internal(const int x, const int y, const int t)
+template <class K>
+Vector3 Raytracer::get_pixel_internal(const float x, const float y, const int t)
 {
-	Vector3 color{ 0, 0, 0 };
 	auto ray = cast_ray(camera_.GenerateRay(x, y), t);
-	auto ior = IOR_AIR;
-	if (!ray_trace(ray, t, color, ior, 0, &Raytracer::get_material_color))
+	pixel_geometry = ray.hit.geomID;
+	if (!has_colision(ray))
 		// Background
-		color = cubeMap_->get_texel(Vector3(ray.ray.dir_x, ray.ray.dir_y, ray.ray.dir_z));
-	return color;
+		return cubeMap_->get_texel(Vector3(ray.ray.dir_x, ray.ray.dir_y, ray.ray.dir_z));
+
+	auto data = build_ray_model(ray, IOR_AIR);
+	return shade<K>(data, get_collision_type<K>(data, 1), t, 1);
+}
+
+int Raytracer::kernel_index() const
+{
+	const int path = path_ ? (path_deep_ ? PathDeep : PathShallow) : PathOff;
+	return shaderSelected * 24 + shadows_ * 12 + refl_ * 6 + refr_ * 3 + path;
+}
+
+template <int Index>
+Raytracer::Kernel Raytracer::find_kernel(const int index)
+{
+	typedef KernelConfig<Index> K;
+	if (index == Index)
+		return { &Raytracer::get_pixel_internal<K>, &Raytracer::get_collision_type<K>,
+			{ &Raytracer::shade_group<K, Diffuse>, &Raytracer::shade_group<K, Reflection>, &Raytracer::shade_group<K, Refraction>,
+			  &Raytracer::shade_group<K, All>, &Raytracer::shade_group<K, RayMap>, &Raytracer::shade_group<K, LightMap> } };
+	return find_kernel<Index - 1>(index);
+}
+
+template <>
+Raytracer::Kernel Raytracer::find_kernel<-1>(const int index)
+{
+	return find_kernel<0>(0);
+}
+
+RenderSettings Raytracer::settings() const
+{
+	RenderSettings settings;
+	settings.shader = shaderSelected;
+	settings.shadows = shadows_;
+	settings.refl = refl_;
+	settings.refr = refr_;
+	settings.max_bumps = RAY_MAX_BUMPS;
+	settings.ray_map = ray_map_;
+	settings.ray_map_bump = RAY_MAP_BUMP;
+	settings.ss = ss_;
+	settings.adaptive = adaptive_;
+	settings.adaptive_threshold = adaptive_threshold_;
+	settings.coherent = coherent_;
+	settings.attribute_mode = attribute_mode_;
+	settings.sky = cubeMap_->returnTexture;
+	settings.sky_color = cubeMap_->color;
+	settings.path = path_;
+	settings.path_deep = path_deep_;
+	settings.roulette = roulette_;
+	settings.path_max_bumps = PATH_MAX_BUMPS;
+	settings.path_samples = PATH_SAMPLES;
+	settings.prune = prune_;
+	settings.prune_threshold = prune_threshold_;
+	settings.branch_roulette = branch_roulette_;
+	settings.animation_time = animation_time_;
+	settings.shutter = shutter_;
+	settings.light = light_;
+	settings.light_power = lightPower_;
+	settings.camera = camera_;
+	return settings;
+}
+
+void Raytracer::apply(const RenderSettings& settings)
+{
+	shaderSelected = settings.shader;
+	shadows_ = settings.shadows;
+	refl_ = settings.refl;
+	refr_ = settings.refr;
+	RAY_MAX_BUMPS = settings.max_bumps;
+	ray_map_ = settings.ray_map;
+	RAY_MAP_BUMP = settings.ray_map_bump;
+	ss_ = settings.ss;
+	adaptive_ = settings.adaptive;
+	adaptive_threshold_ = settings.adaptive_threshold;
+	coherent_ = settings.coherent;
+	attribute_mode_ = settings.attribute_mode;
+	cubeMap_->returnTexture = settings.sky;
+	cubeMap_->color = settings.sky_color;
+	path_ = settings.path;
+	path_deep_ = settings.path_deep;
+	roulette_ = settings.roulette;
+	PATH_MAX_BUMPS = settings.path_max_bumps;
+	PATH_SAMPLES = settings.path_samples;
+	prune_ = settings.prune;
+	prune_threshold_ = settings.prune_threshold;
+	branch_roulette_ = settings.branch_roulette;
+	animation_time_ = settings.animation_time;
+	shutter_ = settings.shutter;
+	light_ = settings.light;
+	lightPower_ = settings.light_power;
+	camera_ = settings.camera;
+	camera_.Update();
+}
+
+void Raytracer::begin_frame()
+{
+	// render threads only see settings changed between passes
+	{
+		std::lock_guard<std::mutex> lock(settings_lock_);
+		if (ui_version_ != applied_version_)
+		{
+			apply(ui_settings_);
+			applied_version_ = ui_version_;
+		}
+	}
+
+	// configuration only changes between frames
+	kernel_ = find_kernel<kKernelCount - 1>(kernel_index());
+	attributes_.SetMode(static_cast<AttributeMode>(attribute_mode_));
+	if (!animated_.empty() && (animation_time_ != applied_time_ || shutter_ != applied_shutter_))
+		SetAnimationTime(animation_time_);
+
+	// reloaded materials replace the current ones as a whole, geometry stays as it is
+	std::vector<Material*> materials;
+	MaterialTable table;
+	if (material_watcher_.Take(materials, table))
+	{
+		for (auto surface : surfaces_)
+		{
+			Material* material = nullptr;
+			for (auto candidate : materials)
+				if (surface->get_material() != nullptr && candidate->get_name() == surface->get_material()->get_name())
+					material = candidate;
+			surface->set_material(material);
+		}
+
+		material_table_ = std::move(table);
+		ReleaseMaterials(materials_);
+		materials_.swap(materials);
+		ClearAccumulator();
+	}
+
+	ray_counts_.resize(width() * height());
+	costs_.resize(width() * height());
+
+	// first samples depend on the pass, they are traced again in every pass
+	base_colors_.resize(width() * height());
+	base_geometry_.resize(width() * height());
+	base_rows_.assign(height(), 0);
+	refined_pixels_ = 0;
+}
+
+void Raytracer::end_frame()
+{
+	ray_stats_.FrameBoundary();
+	refined_fraction_ = refined_pixels_ / float(width() * height());
+	frame_++;
+}
+
+void Raytracer::RenderRows(const int pass, const int y0, const int y1, Color4f* result)
+{
+	// ray statistics are aggregated once per pass, not per lease
+	if (pass != rows_pass_)
+	{
+		FinishRows();
+		rows_pass_ = pass;
+	}
+
+	// the pass selects the sample sequence of every pixel
+	frame_ = pass;
+	NextScratchPass();
+	begin_frame();
+	for (int y = y0; y < y1; ++y)
+		sample_row(y, 0.0f, result + (y - y0) * width());
+}
+
+void Raytracer::FinishRows()
+{
+	if (rows_pass_ >= 0)
+		ray_stats_.FrameBoundary();
+	rows_pass_ = -1;
+}
+
+unsigned long long Raytracer::rays_traced() const
+{
+	return ray_stats_.total();
+}
+
+int Raytracer::path_samples(const int bump) const
+{
+	return path_deep_ ? PATH_SAMPLES : (PATH_SAMPLES / (bump + 1) + 1);
+}
+
+int Raytracer::samples_per_pixel() const
+{
+	// adaptive refinement varies per pixel, only the base grid is counted
+	const int camera = (2 * ss_ + 1) * (2 * ss_ + 1);
+	return path_ ? camera * path_samples(0) : camera;
+}
+
+Raytracer::PixelCost Raytracer::begin_pixel(const int x, const int y, const PixelStream stream)
+{
+	// the base stream keeps the plain seed, earlier renders and checkpoints stay reproducible
+	pixel_random.Seed(seed_ ^ (stream * 0x9E3779B97F4A7C15ull), x, y, frame_);
+	pixel_time = shutter_time(x, y);
+	return PixelCost{ ray_stats_.thread_rays(), Profiler::Now() };
+}
+
+void Raytracer::end_pixel(const int x, const int y, const PixelCost& cost)
+{
+	const int offset = y * width() + x;
+	costs_[offset] += static_cast<float>(Profiler::Now() - cost.ticks);
+	ray_counts_[offset] += static_cast<float>(ray_stats_.thread_rays() - cost.rays);
+}
+
+// blue - cyan - green - yellow - red
+static Vector3 HeatColor(float value)
+{
+	value = value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+	const float r = min(max(4.0f * value - 2.0f, 0.0f), 1.0f);
+	const float g = value < 0.25f ? 4.0f * value : (value > 0.75f ? 4.0f - 4.0f * value : 1.0f);
+	const float b = min(max(2.0f - 4.0f * value, 0.0f), 1.0f);
+	return Vector3(r, g, b);
+}
+
+void Raytracer::save_heatmap(const std::vector<float>& values, const char* file_name)
+{
+	if (values.empty())
+		return;
+
+	// normalize by the 99th percentile so a few outliers do not flatten the map
+	float* sorted = ScratchArena().NewArray<float>(values.size());
+	std::copy(values.begin(), values.end(), sorted);
+	const size_t percentile = values.size() * 99 / 100;
+	std::nth_element(sorted, sorted + percentile, sorted + values.size());
+	const float scale = sorted[percentile] > 0 ? 1.0f / sorted[percentile] : 0.0f;
+
+	ImageWriter::Job job;
+	job.rgba.resize(values.size() * 4);
+	job.width = width();
+	job.height = height();
+	job.file_name = file_name;
+	job.format = kImagePng8;
+	job.display = true;
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		const Vector3 color = HeatColor(values[i] * scale);
+		job.rgba[i * 4 + 0] = color.x;
+		job.rgba[i * 4 + 1] = color.y;
+		job.rgba[i * 4 + 2] = color.z;
+		job.rgba[i * 4 + 3] = 1.0f;
+	}
+	writer_.Submit(std::move(job));
+}
+
+unsigned long long Raytracer::settings_hash() const
+{
+	unsigned long long hash = SimpleGuiDX11::settings_hash();
+	hash = HashBytes(scene_file_.data(), scene_file_.size(), hash);
+	// an edited scene must not resume the samples of the old one, a missing animation hashes as -1
+	for (const std::string& input : scene_inputs_)
+	{
+		const long long modified = MaterialWatcher::Modified(input);
+		hash = HashBytes(input.data(), input.size(), hash);
+		hash = HashBytes(&modified, sizeof(modified), hash);
+	}
+
+	const int ints[] = { kernel_index(), ss_, adaptive_, RAY_MAX_BUMPS, RAY_MAP_BUMP, ray_map_, PATH_SAMPLES, PATH_MAX_BUMPS,
+		roulette_, prune_, branch_roulette_, attribute_mode_, cubeMap_->returnTexture, motion_steps_ };
+	hash = HashBytes(ints, sizeof(ints), hash);
+
+	const float floats[] = { SS_D, SS_MD, adaptive_threshold_, prune_threshold_, camera_.fov_y_, animation_time_, shutter_,
+		camera_.view_from_.x, camera_.view_from_.y, camera_.view_from_.z,
+		camera_.view_at_.x, camera_.view_at_.y, camera_.view_at_.z,
+		light_.x, light_.y, light_.z, lightPower_.x, lightPower_.y, lightPower_.z };
+	return HashBytes(floats, sizeof(floats), hash);
+}
+
+void Raytracer::store_state(Checkpoint& checkpoint) const
+{
+	SimpleGuiDX11::store_state(checkpoint);
+	checkpoint.seed = seed_;
+	checkpoint.frame = frame_;
+}
+
+void Raytracer::restore_state(const Checkpoint& checkpoint)
+{
+	SimpleGuiDX11::restore_state(checkpoint);
+	seed_ = checkpoint.seed;
+	frame_ = checkpoint.frame;
+}
+
+void Raytracer::save_extra(const char* prefix)
+{
+	if (!heatmaps_)
+		return;
+
+	char path[128];
+	sprintf(path, "%s_rays", prefix);
+	save_heatmap(ray_counts_, path);
+	sprintf(path, "%s_cost", prefix);
+	save_heatmap(costs_, path);
 }
 
 Color4f Raytracer::get_pixel(const int x, const int y, const float t)
 {
-	auto start = begin();
+	const PixelCost cost = begin_pixel(x, y);
+	costs_[y * width() + x] = 0;
+	ray_counts_[y * width() + x] = 0;
 
 	Vector3 color(0, 0, 0);
 	if (ss_ == 0)
-		color = get_pixel_internal(x, y, t);
+		color = (this->*kernel_.pixel)(x, y, t);
 	else
 	{
 		int count = 0;
@@ -702,43 +1385,162 @@ Color4f Raytracer::get_pixel(const int x, const int y, const float t)
 				const float dx = i * (SS_MD / ss_) + nx / ss_, dy = j * (SS_MD / ss_) + (ny / ss_);
 				//const float dx = nx, dy = ny;
 				//const float dx = i * 0.25f, dy = j * 0.25f;
-				color += get_pixel_internal(x + dx, y + dy, t);
+				color += (this->*kernel_.pixel)(x + dx, y + dy, t);
 				count++;
 			}
 		color /= (float)count;
 	}
 
+	end_pixel(x, y, cost);
+
+	return Color4f{ color.x, color.y, color.z, 1 };
+}
+
+// one ray tree without supersampling, the heatmaps only describe full passes
+Color4f Raytracer::preview_pixel(const int x, const int y, const float t)
+{
+	begin_pixel(x, y);
+	const Vector3 color = (this->*kernel_.pixel)(x, y, t);
+	return Color4f{ color.x, color.y, color.z, 1 };
+}
+
+// samples of the refinement are at most (2 * ss_ + 1)^2 like the full grid, the quadtree depth is rounded down
+int Raytracer::adaptive_depth() const
+{
+	const int samples = (2 * ss_ + 1) * (2 * ss_ + 1);
+	int depth = 1;
+	while (1 << (2 * (depth + 1)) <= samples)
+		depth++;
+	return depth;
+}
+
+// contrast of Mitchell's adaptive sampling, |a - b| / (a + b) of any channel
+bool Raytracer::contrast(const Vector3& a, const Vector3& b) const
+{
+	const float eps = 1e-4f;
+	return fabsf(a.x - b.x) > adaptive_threshold_ * (a.x + b.x + eps) ||
+		fabsf(a.y - b.y) > adaptive_threshold_ * (a.y + b.y + eps) ||
+		fabsf(a.z - b.z) > adaptive_threshold_ * (a.z + b.z + eps);
+}
+
+void Raytracer::base_row(const int y, const float t)
+{
+	if (y < 0 || y >= height() || base_rows_[y])
+		return;
+
+	const int width = this->width();
+	#pragma omp parallel
+	{
+		PROFILE_ZONE(kZonePixel);
+		PERF_RAY_STAGE(kStagePixel, &ray_stats_);
+		#pragma omp for
+		for (int x = 0; x < width; ++x)
+		{
+			const PixelCost cost = begin_pixel(x, y);
+			costs_[y * width + x] = 0;
+			ray_counts_[y * width + x] = 0;
+			base_colors_[y * width + x] = (this->*kernel_.pixel)(x, y, t);
+			base_geometry_[y * width + x] = pixel_geometry;
+			end_pixel(x, y, cost);
+		}
+	}
+	base_rows_[y] = 1;
+}
+
+// geometry and material edges, a different geomID implies a different surface and so a different material
+bool Raytracer::is_edge(const int x, const int y) const
+{
+	const int width = this->width();
+	const int offset = y * width + x;
+	const int neighbours[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+	for (const auto& d : neighbours)
+	{
+		const int nx = x + d[0], ny = y + d[1];
+		if (nx < 0 || nx >= width || ny < 0 || ny >= height())
+			continue;
+		const int other = ny * width + nx;
+		if (base_geometry_[offset] != base_geometry_[other] || contrast(base_colors_[offset], base_colors_[other]))
+			return true;
+	}
+	return false;
+}
 
-	if (debug_)
+// averages four jittered samples of the square centred at (x, y), quadrants whose samples
+// still differ are subdivided until the depth runs out
+Vector3 Raytracer::refine(const float x, const float y, const float size, const int depth, const float t)
+{
+	const float quarter = size * 0.25f;
+	Vector3 colors[4];
+	unsigned int geometry[4];
+	for (int q = 0; q < 4; ++q)
 	{
-		log(start, "get_pixel");
+		const float qx = x + ((q & 1) ? quarter : -quarter) + get_random_ss_float() * size;
+		const float qy = y + ((q & 2) ? quarter : -quarter) + get_random_ss_float() * size;
+		colors[q] = (this->*kernel_.pixel)(qx, qy, t);
+		geometry[q] = pixel_geometry;
+	}
+
+	bool uniform = true;
+	for (int q = 1; q < 4 && uniform; ++q)
+		uniform = geometry[q] == geometry[0] && !contrast(colors[q], colors[0]);
 
-		if (x == 1)
+	Vector3 color(0, 0, 0);
+	for (int q = 0; q < 4; ++q)
+		if (uniform || depth <= 1)
+			color += colors[q];
+		else
+			color += refine(x + ((q & 1) ? quarter : -quarter), y + ((q & 2) ? quarter : -quarter), size * 0.5f, depth - 1, t);
+	return color / 4.0f;
+}
+
+void Raytracer::sample_row_adaptive(const int y, const float t, Color4f* result)
+{
+	// neighbours of the row above and below take part in the edge test
+	base_row(y - 1, t);
+	base_row(y, t);
+	base_row(y + 1, t);
+
+	const int width = this->width();
+	const int depth = adaptive_depth();
+	int refined = 0;
+	#pragma omp parallel reduction(+:refined)
+	{
+		PROFILE_ZONE(kZonePixel);
+		PERF_RAY_STAGE(kStagePixel, &ray_stats_);
+		#pragma omp for schedule(dynamic)
+		for (int x0 = 0; x0 < width; x0 += kCancelPixels)
 		{
-#pragma omp critical
+			if (restart_pending())
+				continue;
+			for (int x = x0; x < min(x0 + kCancelPixels, width); ++x)
 			{
-				auto max = 0.0f;
-				for (auto& x : times)
-					if (x.second > max)
-						max += x.second;
-				times_text.clear();
-				for (auto& x : times)
-					times_text.append(std::to_string((int)(x.second / max * 100.f)) + " %\t\t" + x.first + "\t\t\t" + std::to_string(x.second / 1000.0f) + " s\n");
+				const Vector3& base = base_colors_[y * width + x];
+				if (!is_edge(x, y))
+				{
+					store_color(result[x], base);
+					continue;
+				}
+
+				// the first sample is kept as one of the samples of the pixel
+				const PixelCost cost = begin_pixel(x, y, kStreamRefine);
+				const Vector3 color = (base + refine(x, y, 1.0f, depth, t) * 4.0f) / 5.0f;
+				end_pixel(x, y, cost);
+				store_color(result[x], color);
+				refined++;
 			}
 		}
 	}
-
-	return Color4f{ color.x, color.y, color.z, 1 };
+	refined_pixels_ += refined;
 }
 
 float Raytracer::get_random_float()
 {
-	return dist_(e2_);
+	return pixel_random.Uniform();
 }
 
 float Raytracer::get_random_ss_float()
 {
-	return ss_dist_(ss_e2_);
+	return (2.0f * pixel_random.Uniform() - 1.0f) * SS_D;
 }
 
 int Raytracer::Ui()
@@ -757,75 +1559,121 @@ int Raytracer::Ui()
 	//ImGui::Text("Time = %.2f", lastFrame_.count());
 	ImGui::Text("Surfaces = %d", surfaces_.size());
 	ImGui::SameLine(); ImGui::Text("Materials = %d", materials_.size());
+	ImGui::SameLine(); ImGui::Text("Scene arena = %.1f MB", scene_arena_.capacity() / 1048576.0);
 	ImGui::Separator();
 	ImGui::Checkbox("Vsync", &vsync_);
 	ImGui::SameLine(); ImGui::Checkbox("Save", &save_);
+	ImGui::SameLine(); ImGui::Checkbox("Heatmaps", &heatmaps_);
+	ImGui::SameLine(); ImGui::Checkbox("Checkpoints", &checkpoint_);
+	ImGui::Combo("Save format", &save_format_, "PNG 8-bit\0PNG 16-bit\0EXR\0PFM\0\0");
 	ImGui::Checkbox("Accumulator", &accumulator_); 
+	ImGui::SameLine(); ImGui::Checkbox("Preview", &preview_);
 	ImGui::SameLine(); ImGui::Text("Samples = %d", (int)n);
 	ImGui::SameLine(); if (ImGui::Button("Clear Accumulator"))
-	{
-		n = 0;
-		for (int y = 0; y < height(); ++y)
-			for (int x = 0; x < width(); ++x)
-			{
-				const int offset = (y * width() + x) * 4;
-				for (int c = 0; c < 4; c++)
-					accumulator[offset + c] = 0.f;
-			}
-	}
+		Restart();
 	ImGui::Separator();
 	//ImGui::Checkbox("Debug", &debug_);
-	ImGui::SliderInt("Super Sampling", &ss_, 0, 9);
-	ImGui::ListBox("Shader", &shaderSelected, shaderNames, IM_ARRAYSIZE(shaderNames));
-	ImGui::Checkbox("Shadows", &shadows_);
-	ImGui::Checkbox("Cubemap texture", &cubeMap_->returnTexture);
-	if (!cubeMap_->returnTexture)
+
+	// only the UI thread writes ui_settings_, edits are published under the lock
+	if (!ui_settings_ready_)
+	{
+		std::lock_guard<std::mutex> lock(settings_lock_);
+		ui_settings_ = settings();
+		ui_settings_ready_ = true;
+	}
+	RenderSettings edit = ui_settings_;
+	bool changed = false;
+
+	changed |= ImGui::SliderInt("Super Sampling", &edit.ss, 0, 9);
+	changed |= ImGui::Checkbox("Adaptive", &edit.adaptive);
+	if (edit.adaptive)
+	{
+		ImGui::SameLine(); ImGui::Text("Refined = %.1f %%", refined_fraction_ * 100.0f);
+		changed |= ImGui::SliderFloat("Contrast threshold", &edit.adaptive_threshold, 0.01f, 1.0f);
+	}
+	changed |= ImGui::Checkbox("Coherent shading", &edit.coherent);
+	changed |= ImGui::Combo("Attributes", &edit.attribute_mode, "Full\0Quantized\0");
+	// the loader vertices stay resident in both modes, quantizing shrinks only the arrays read while shading
+	ImGui::Text("Geometry = %.1f MB (attributes %.1f MB, loader and Embree vertices %.1f MB)",
+		(attributes_.memory() + attributes_.vertex_memory()) / 1048576.0, attributes_.memory() / 1048576.0,
+		attributes_.vertex_memory() / 1048576.0);
+	ImGui::Text("Attributes full = %.1f MB, quantized = %.1f MB",
+			attributes_.memory(kAttributesFull) / 1048576.0, attributes_.memory(kAttributesQuantized) / 1048576.0);
+	changed |= ImGui::ListBox("Shader", &edit.shader, shaderNames, IM_ARRAYSIZE(shaderNames));
+	changed |= ImGui::Checkbox("Shadows", &edit.shadows);
+	changed |= ImGui::Checkbox("Cubemap texture", &edit.sky);
+	if (!edit.sky)
 	{
-		ImGui::SliderFloat("Cubemap R", &cubeMap_->color.x, 0.0f, 1.0f); // Edit 1 float using a slider from 0.0f to 1.0f    
-		ImGui::SliderFloat("Cubemap G", &cubeMap_->color.y, 0.0f, 1.0f); // Edit 1 float using a slider from 0.0f to 1.0f    
-		ImGui::SliderFloat("Cubemap B", &cubeMap_->color.z, 0.0f, 1.0f); // Edit 1 float using a slider from 0.0f to 1.0f    
+		changed |= ImGui::SliderFloat("Cubemap R", &edit.sky_color.x, 0.0f, 1.0f); // Edit 1 float using a slider from 0.0f to 1.0f    
+		changed |= ImGui::SliderFloat("Cubemap G", &edit.sky_color.y, 0.0f, 1.0f); // Edit 1 float using a slider from 0.0f to 1.0f    
+		changed |= ImGui::SliderFloat("Cubemap B", &edit.sky_color.z, 0.0f, 1.0f); // Edit 1 float using a slider from 0.0f to 1.0f    
 	}
 	ImGui::Separator();
-	ImGui::SliderInt("Ray tracing depth", &RAY_MAX_BUMPS, 0, 20);
-	ImGui::Checkbox("Ray tracing map", &ray_map_);
-	if (ray_map_)
-		ImGui::SliderInt("Ray tracing map depth", &RAY_MAP_BUMP, 0, RAY_MAX_BUMPS);
-	ImGui::Checkbox("Reflection", &refl_);
-	ImGui::SameLine(); ImGui::Checkbox("Refraction", &refr_);
+	changed |= ImGui::SliderInt("Ray tracing depth", &edit.max_bumps, 0, 20);
+	changed |= ImGui::Checkbox("Ray tracing map", &edit.ray_map);
+	if (edit.ray_map)
+		changed |= ImGui::SliderInt("Ray tracing map depth", &edit.ray_map_bump, 0, edit.max_bumps);
+	changed |= ImGui::Checkbox("Reflection", &edit.refl);
+	ImGui::SameLine(); changed |= ImGui::Checkbox("Refraction", &edit.refr);
+	changed |= ImGui::Checkbox("Prune branches", &edit.prune);
+	ImGui::SameLine(); changed |= ImGui::Checkbox("Branch selection", &edit.branch_roulette);
+	if (edit.prune)
+		changed |= ImGui::SliderFloat("Prune threshold", &edit.prune_threshold, 0.001f, 0.1f, "%.3f");
 	ImGui::Separator();
-	ImGui::Checkbox("Path tracing", &path_);
-	ImGui::SameLine(); ImGui::Checkbox("Deep path tracing", &path_deep_);
-	ImGui::SliderInt("Path tracing depth", &PATH_MAX_BUMPS, 0, 20);
-	ImGui::SliderInt("Path tracing samples", &PATH_SAMPLES, 1, 10);
+	changed |= ImGui::Checkbox("Path tracing", &edit.path);
+	ImGui::SameLine(); changed |= ImGui::Checkbox("Deep path tracing", &edit.path_deep);
+	ImGui::SameLine(); changed |= ImGui::Checkbox("Russian roulette", &edit.roulette);
+	changed |= ImGui::SliderInt("Path tracing depth", &edit.path_max_bumps, 0, 20);
+	changed |= ImGui::SliderInt("Path tracing samples", &edit.path_samples, 1, 10);
+	ImGui::Separator();
+	if (!animated_.empty())
+	{
+		changed |= ImGui::SliderFloat("Animation time", &edit.animation_time, 0.0f, animation_.duration());
+		changed |= ImGui::SliderFloat("Shutter", &edit.shutter, 0.0f, 0.1f);
+		ImGui::SameLine(); ImGui::Text("Motion steps = %d", motion_steps_);
+		ImGui::Text("Animated objects = %d, refit %.3f ms", (int)animated_.size(), build_seconds_ * 1e3);
+		ImGui::Separator();
+	}
+	ray_stats_.Ui();
+	PerfCounters::Instance().Ui();
 	ImGui::Separator();
 
 	//ImGui::Checkbox( "Demo Window", &show_demo_window ); // Edit bools storing our window open/close state
 	//ImGui::Checkbox( "Another Window", &show_another_window );
-	ImGui::SliderFloat("Light X", &light_.x, -1000.0f, 1000.0f); // Edit 1 float using a slider from 0.0f to 1.0f    
-	ImGui::SliderFloat("Light Y", &light_.y, -1000.0f, 1000.0f); // Edit 1 float using a slider from 0.0f to 1.0f   
-	ImGui::SliderFloat("Light Z", &light_.z, -1000.0f, 1000.0f); // Edit 1 float using a slider from 0.0f to 1.0f   
-	ImGui::SliderFloat("Light Power R", &lightPower_.x, 0.f, 1.f); // Edit 1 float using a slider from 0.0f to 1.0f    
-	ImGui::SliderFloat("Light Power G", &lightPower_.y, 0.f, 1.f); // Edit 1 float using a slider from 0.0f to 1.0f   
-	ImGui::SliderFloat("Light Power B", &lightPower_.z, 0.f, 1.f); // Edit 1 float using a slider from 0.0f to 1.0f   
+	changed |= ImGui::SliderFloat("Light X", &edit.light.x, -1000.0f, 1000.0f); // Edit 1 float using a slider from 0.0f to 1.0f    
+	changed |= ImGui::SliderFloat("Light Y", &edit.light.y, -1000.0f, 1000.0f); // Edit 1 float using a slider from 0.0f to 1.0f   
+	changed |= ImGui::SliderFloat("Light Z", &edit.light.z, -1000.0f, 1000.0f); // Edit 1 float using a slider from 0.0f to 1.0f   
+	changed |= ImGui::SliderFloat("Light Power R", &edit.light_power.x, 0.f, 1.f); // Edit 1 float using a slider from 0.0f to 1.0f    
+	changed |= ImGui::SliderFloat("Light Power G", &edit.light_power.y, 0.f, 1.f); // Edit 1 float using a slider from 0.0f to 1.0f   
+	changed |= ImGui::SliderFloat("Light Power B", &edit.light_power.z, 0.f, 1.f); // Edit 1 float using a slider from 0.0f to 1.0f   
 	ImGui::Separator();
-	ImGui::SliderFloat("Camera X", &camera_.view_from_.x, -1000.0f, 1000.0f); // Edit 1 float using a slider from 0.0f to 1.0f    
-	ImGui::SliderFloat("Camera Y", &camera_.view_from_.y, -1000.0f, 1000.0f); // Edit 1 float using a slider from 0.0f to 1.0f   
-	ImGui::SliderFloat("Camera Z", &camera_.view_from_.z, -1000.0f, 1000.0f); // Edit 1 float using a slider from 0.0f to 1.0f   
-	ImGui::SliderFloat("Target X", &camera_.view_at_.x, -1000.0f, 1000.0f); // Edit 1 float using a slider from 0.0f to 1.0f    
-	ImGui::SliderFloat("Target Y", &camera_.view_at_.y, -1000.0f, 1000.0f); // Edit 1 float using a slider from 0.0f to 1.0f   
-	ImGui::SliderFloat("Target Z", &camera_.view_at_.z, -1000.0f, 1000.0f); // Edit 1 float using a slider from 0.0f to 1.0f   
+	// the camera basis is rebuilt when the settings are applied
+	changed |= ImGui::SliderFloat("Camera X", &edit.camera.view_from_.x, -1000.0f, 1000.0f); // Edit 1 float using a slider from 0.0f to 1.0f    
+	changed |= ImGui::SliderFloat("Camera Y", &edit.camera.view_from_.y, -1000.0f, 1000.0f); // Edit 1 float using a slider from 0.0f to 1.0f   
+	changed |= ImGui::SliderFloat("Camera Z", &edit.camera.view_from_.z, -1000.0f, 1000.0f); // Edit 1 float using a slider from 0.0f to 1.0f   
+	changed |= ImGui::SliderFloat("Target X", &edit.camera.view_at_.x, -1000.0f, 1000.0f); // Edit 1 float using a slider from 0.0f to 1.0f    
+	changed |= ImGui::SliderFloat("Target Y", &edit.camera.view_at_.y, -1000.0f, 1000.0f); // Edit 1 float using a slider from 0.0f to 1.0f   
+	changed |= ImGui::SliderFloat("Target Z", &edit.camera.view_at_.z, -1000.0f, 1000.0f); // Edit 1 float using a slider from 0.0f to 1.0f   
 	//ImGui::ColorEdit3( "clear color", ( float* )&clear_color ); // Edit 3 floats representing a color
 
-	// Buttons return true when clicked (most widgets return true when edited/activated)
-	if (ImGui::Button("Update Target"))
-		camera_.Update();
+	if (changed)
+	{
+		{
+			std::lock_guard<std::mutex> lock(settings_lock_);
+			ui_settings_ = edit;
+			ui_version_++;
+		}
+		Restart();
+	}
+
 	//counter++;
 /*ImGui::SameLine();
 ImGui::Text( "counter = %d", counter );*/
-//ImGui::Text("Functions:\n%s", times_text.c_str());
 
 	ImGui::End();
 
+	Profiler::Instance().Ui();
+
 	// 3. Show another simple window.
 	/*if ( show_another_window )
 	{
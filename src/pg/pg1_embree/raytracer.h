@@ -6,6 +6,10 @@
 #include "RTCRayHitModel.h"
 #include "RayCollision.h"
 #include "Sample.h"
+#include "raystats.h"
+#include "animation.h"
+#include "materialwatcher.h"
+#include "arena.h"
 
 /*! \class Raytracer
 \brief General ray tracer class.
@@ -17,14 +21,91 @@
 
 #define Color_Empty Vector3{0,0,0}
 enum SampleMode { CosWeighted, CosLobe };
+
+/* orthonormal basis with N as the z axis */
+Matrix3x3 createCoordinateSystem(Vector3 N);
+
+/* number of RayCollision values used to build shading keys */
+const int kCollisionTypes = LightMap + 1;
+/* maximal number of hits shaded by one kernel call */
+const int kShadingGroupSize = 16;
+/* number of hits interpolated by one batch call */
+const int kInterpolationBatch = 64;
+
+enum PathMode { PathOff, PathShallow, PathDeep };
+
+/* compile time render configuration decoded from a kernel index,
+   the integrator is instantiated once for every combination */
+template <int Index>
+struct KernelConfig
+{
+	static const int shader = Index / 24; // Raytracer::shaderSelected
+	static const bool shadows = (Index / 12) % 2 == 1;
+	static const bool refl = (Index / 6) % 2 == 1;
+	static const bool refr = (Index / 3) % 2 == 1;
+	static const int path = Index % 3; // PathMode
+};
+const int kKernelCount = 5 * 24;
+
+/* consecutive range of sorted hits with the same material and collision type */
+struct ShadingGroup
+{
+	int begin;
+	int end;
+	RayCollision collision;
+};
+
+/* settings the UI can change that affect the image, the UI edits a copy
+   which the producer applies at the start of a pass */
+struct RenderSettings
+{
+	int shader;
+	bool shadows;
+	bool refl;
+	bool refr;
+	int max_bumps;
+	bool ray_map;
+	int ray_map_bump;
+	int ss;
+	bool adaptive;
+	float adaptive_threshold;
+	bool coherent;
+	int attribute_mode;
+	bool sky;
+	Vector3 sky_color;
+	bool path;
+	bool path_deep;
+	bool roulette;
+	int path_max_bumps;
+	int path_samples;
+	bool prune;
+	float prune_threshold;
+	bool branch_roulette;
+	float animation_time;
+	float shutter;
+	Vector3 light;
+	Vector3 light_power;
+	Camera camera;
+};
+
 class Raytracer : public SimpleGuiDX11
 {
 public:
+	/* entry points of one specialized integrator instance */
+	struct Kernel
+	{
+		Vector3(Raytracer::* pixel)(const float x, const float y, const int t);
+		RayCollision(Raytracer::* collision)(RTCRayHitModel& hit, const int bump);
+		// indexed by the collision type of the group
+		void(Raytracer::* shade_group[kCollisionTypes])(const ShadingGroup& group, const float& t, Color4f* result);
+	};
+
 	Raytracer( const int width, const int height, 
 		const float fov_y, const Vector3 view_from, const Vector3 view_at,
 		Vector3* light, Vector3* lightPower,
 		const Vector3* background = nullptr,
-		const char * config = "threads=0,verbose=3");
+		const char * config = "threads=0,verbose=3",
+		const bool headless = false);
 	~Raytracer();
 
 	int InitDeviceAndScene( const char * config );
@@ -32,42 +113,68 @@ public:
 	int ReleaseDeviceAndScene();
 
 	void LoadScene( const std::string file_name );
-	bool check_shadow(RTCRayHitModel& hit, const float& t, const Vector3& lightVector);
-	Vector3 get_material_color(RTCRayHitModel& hit, const float& t, int bump = 0);
+	// detaches all geometry, the device and the environment map stay loaded
+	void UnloadScene();
+	void SetView( const float fov_y, const Vector3 view_from, const Vector3 view_at, const Vector3 light, const Vector3 light_power );
+	// restarts the per pixel sample sequences, renders are reproducible for a fixed seed
+	void ResetSequence( const unsigned int seed );
+	const std::string & scene_file() const;
+	// moves the animated objects to the given time and refits the BVH
+	void SetAnimationTime( const float time );
+	// deterministic shutter position in [0, 1) of a pixel sample, 0 without motion blur
+	float shutter_time( const int x, const int y ) const;
+	template <class K> bool check_shadow(RTCRayHitModel& hit, const float& t, const Vector3& lightVector, const int bump);
+	template <class K> Vector3 get_material_color(RTCRayHitModel& hit, const float& t, int bump = 0);
 
 	// Shaders Raytracer
-	Vector3 shader_normal(RTCRayHitModel& hit, const float& t);
-	Vector3 shader_lambert(RTCRayHitModel& hit, const float& t);
-	Vector3 shader_phong(RTCRayHitModel& hit, const float& t);
-	Vector3 shader_shadow(RTCRayHitModel& hit, const float& t);
-	Vector3 shader_light(RTCRayHitModel& hit, const float& t);
+	template <class K> Vector3 shader_normal(RTCRayHitModel& hit, const float& t, const int bump);
+	template <class K> Vector3 shader_lambert(RTCRayHitModel& hit, const float& t, const int bump);
+	template <class K> Vector3 shader_phong(RTCRayHitModel& hit, const float& t, const int bump);
+	template <class K> Vector3 shader_shadow(RTCRayHitModel& hit, const float& t, const int bump);
+	template <class K> Vector3 shader_light(RTCRayHitModel& hit, const float& t, const int bump);
 	int shaderSelected = 4;
 	const char* shaderNames[5] = { "Normal", "Light", "Shadow", "Lambert", "Phong" };
 	
 	// Samping
-	Sample sample_hemisphere(RTCRayHitModel& hit, const float& t, Matrix3x3& world, SampleMode mode);
-	Sample prepare_sample(RTCRayHitModel& hit, const float& t, Sample& sample, SampleMode mode);
+	Sample sample_hemisphere(RTCRayHitModel& hit, const float& t, Matrix3x3& world, SampleMode mode, const int depth);
+	Sample prepare_sample(RTCRayHitModel& hit, const float& t, Sample& sample, SampleMode mode, const RayType type, const int depth);
 
 	// Ray Trace sample functions
-	Vector3 get_material_shader_color(RTCRayHitModel& hit, const float& t, int bump = 0);
-	Vector3 path_trace(RTCRayHitModel& hit, const float& t, int bump = 0);
+	template <class K> Vector3 get_material_shader_color(RTCRayHitModel& hit, const float& t, int bump = 0);
+	template <class K> Vector3 path_trace(RTCRayHitModel& hit, const float& t, int bump = 0);
 
-	bool ray_trace(RTCRayHit ray_hit, const float& t, Vector3& color, float& n1, int bump, Vector3(Raytracer::*shader)(RTCRayHitModel&, const float&, int bump));
-	Vector3 get_pixel_internal(int x, int y, int t);
+	// Whitted ray tree of a hit, traced without recursion using a per thread stack of pending rays
+	template <class K> Vector3 shade_tree(RTCRayHitModel& data, const RayCollision collision, const float& t, int bump);
+	template <class K> Vector3 expand(RTCRayHitModel& data, RayCollision collision, const float& t, int bump, const Vector3& weight);
+	bool survives(float& throughput, Vector3& weight);
+	static float medium_weight(RTCRayHitModel& data);
+	template <class K> Vector3 shade(RTCRayHitModel& data, const RayCollision collision, const float& t, int bump);
+	template <class K> Vector3 shade_ray_map(RTCRayHitModel& data, const float& t, int bump);
+	template <class K> Vector3 get_pixel_internal(const float x, const float y, const int t);
 	Color4f get_pixel( const int x, const int y, const float t = 0.0f ) override;
+	void sample_row(const int y, const float t, Color4f* result) override;
+	Color4f preview_pixel(const int x, const int y, const float t) override;
+	void begin_frame() override;
+	// renders rows [y0, y1) of the given pass, row by row into result, used by distributed workers
+	void RenderRows(const int pass, const int y0, const int y1, Color4f* result);
+	// aggregates the ray statistics of the last pass rendered by RenderRows
+	void FinishRows();
+	void end_frame() override;
 	float get_random_float();
 	float get_random_ss_float();
 	RTCRayHit prepare_ray_hit(float t, RTCRay ray, const float& tnear = 0.1f);
 	RTCRay generate_ray(const Vector3& hit, const Vector3& direction);
-	RTCRayHit cast_ray(const Vector3& position, const Vector3& direction, const float& t, const float& tnear = 0.1f);
+	RTCRayHit cast_ray(const Vector3& position, const Vector3& direction, const float& t, const RayType type, const int depth, const float& tnear = 0.1f);
 	RTCRayHit cast_ray(const RTCRay& ray, const float& t);
 	RTCRayHitModel build_ray_model(const RTCRayHit& hit, const float& ior);
 	static bool has_colision(const RTCRayHit& hit);
 	static bool has_colision(const RTCRayHitModel& hit);
-	RayCollision get_collision_type(RTCRayHitModel& hit, const int bump);
-	int get_ray_count(RTCRayHit ray_hit, const float& t, float& n1, int bump);
+	template <class K> RayCollision get_collision_type(RTCRayHitModel& hit, const int bump);
+	template <class K> RayCollision get_surface_collision(RTCRayHitModel& hit, const int bump);
 
 	int Ui();
+	RenderSettings settings() const;
+	void apply(const RenderSettings& settings);
 
 	bool shadows_{ true };
 
@@ -81,23 +188,132 @@ public:
 
 	float SS_D = 0.25f, SS_MD = 0.25f;
 	int ss_ = 0;
+	// adaptive supersampling, ss_ only limits the number of samples of refined pixels
+	bool adaptive_{ false };
+	float adaptive_threshold_{ 0.25f }; // contrast between neighbouring samples that is refined
+
+	bool coherent_{ true };
+	bool heatmaps_{ true };
+	void save_extra(const char* prefix) override;
+	unsigned long long settings_hash() const override;
+	void store_state(Checkpoint& checkpoint) const override;
+	void restore_state(const Checkpoint& checkpoint) override;
+	RayStats* ray_stats() override { return &ray_stats_; }
+	int attribute_mode_{ kAttributesFull };
 
 	int PATH_SAMPLES = 5;
 	int PATH_MAX_BUMPS = 5;
 	bool path_{ false }; 
 	bool path_deep_{ true };
+	bool roulette_{ true };
+
+	// Whitted branches whose weight drops below prune_threshold_ survive Russian roulette only,
+	// branch_roulette_ follows one of the reflected and refracted rays chosen by the Fresnel term
+	bool prune_{ true };
+	float prune_threshold_{ 0.01f };
+	bool branch_roulette_{ false };
+
+	// animation, the time is applied at the next frame start
+	float animation_time_{ 0.0f }; // seconds
+	int motion_steps_{ 1 }; // Embree time steps of animated objects, more than one enables motion blur, fixed at LoadScene
+	float shutter_{ 1.0f / 48.0f }; // seconds the shutter stays open after animation_time_
+	const Animation & animation() const;
 	
 	CubeMap* cubeMap_;
+
+	// base seed of the per pixel generators, fixed by benchmarks
+	unsigned int seed_{ 0 };
+	double load_seconds_{ 0 };
+	double build_seconds_{ 0 };
+	unsigned long long rays_traced() const;
+	// indirect samples drawn at a hit of the given bounce, shallow paths draw fewer the deeper they go
+	int path_samples(const int bump) const;
+	// camera samples of one pixel per pass, the indirect samples of the first bounce included
+	int samples_per_pixel() const;
 private:
-	std::random_device rd_;
-	std::mt19937 e2_;
-	uniform_real_distribution<float> dist_;
 
-	std::mt19937 ss_e2_;
-	uniform_real_distribution<float> ss_dist_;
+	std::string scene_file_;
+	// OBJ, MTL, texture and animation files of the scene, their modification times are part of the settings hash
+	std::vector<std::string> scene_inputs_;
+	// objects with keyframes, their Embree vertex buffers are rewritten per frame
+	struct AnimatedGeometry
+	{
+		unsigned int geom_id;
+		Surface* surface;
+		const std::vector<Keyframe>* keys;
+		Vector3 pivot; // center of the bounding box in rest pose
+	};
+	Animation animation_;
+	MaterialWatcher material_watcher_;
+	std::vector<AnimatedGeometry> animated_;
+	float applied_time_{ -1.0f };
+	float applied_shutter_{ -1.0f };
 
+	// settings edited by the UI thread, versioned so the producer applies every change once
+	std::mutex settings_lock_;
+	RenderSettings ui_settings_;
+	bool ui_settings_ready_{ false };
+	unsigned int ui_version_{ 0 };
+	unsigned int applied_version_{ 0 };
+	Arena scene_arena_{ 16 * 1024 * 1024 }; // surfaces and their triangles, released at once by UnloadScene
 	std::vector<Surface *> surfaces_;
 	std::vector<Material *> materials_;
+	MaterialTable material_table_;
+	MeshAttributes attributes_;
+	RayStats ray_stats_;
+
+	// Per pixel rays and TSC ticks of the last pass, saved as heatmaps
+	struct PixelCost
+	{
+		unsigned long long rays;
+		unsigned long long ticks;
+	};
+	std::vector<float> ray_counts_;
+	std::vector<float> costs_;
+	int row_{ 0 };
+	// independent random streams of one pixel and pass
+	enum PixelStream
+	{
+		kStreamBase,
+		kStreamRefine, // adaptive refinement, must not repeat the samples of the base grid
+	};
+	// seeds the pixel generator and starts measuring the pixel cost
+	PixelCost begin_pixel(const int x, const int y, const PixelStream stream = kStreamBase);
+	void end_pixel(const int x, const int y, const PixelCost& cost);
+	int frame_{ 0 };
+	int rows_pass_{ -1 }; // pass of the last RenderRows call, its statistics are not aggregated yet
+	void save_heatmap(const std::vector<float>& values, const char* file_name);
+
+	// Material coherent shading buffers, one row at a time
+	std::vector<RTCRayHit> rays_;
+	std::vector<Normal3f> normals_;
+	std::vector<Coord2f> tex_coords_;
+	std::vector<RTCRayHitModel> hits_;
+	std::vector<int> keys_;
+	std::vector<int> key_offsets_;
+	std::vector<int> order_;
+	std::vector<ShadingGroup> groups_;
+	template <class K, RayCollision C> void shade_group(const ShadingGroup& group, const float& t, Color4f* result);
+
+	// Integrator instance selected at frame start from the UI configuration
+	Kernel kernel_;
+	int kernel_index() const;
+	template <int Index> Kernel find_kernel(const int index);
+	static void store_color(Color4f& pixel, const Vector3& color);
+
+	// Adaptive supersampling, one sample per pixel is traced first and only
+	// pixels differing from a neighbour are refined
+	void sample_row_adaptive(const int y, const float t, Color4f* result);
+	void base_row(const int y, const float t);
+	bool is_edge(const int x, const int y) const;
+	Vector3 refine(const float x, const float y, const float size, const int depth, const float t);
+	int adaptive_depth() const;
+	bool contrast(const Vector3& a, const Vector3& b) const;
+	std::vector<Vector3> base_colors_; // first sample of every pixel of the pass
+	std::vector<unsigned int> base_geometry_; // geomID hit by the first sample
+	std::vector<char> base_rows_; // rows of the pass with their first samples traced
+	int refined_pixels_{ 0 };
+	float refined_fraction_{ 0 }; // of the last pass
 
 	RTCDevice device_;
 	RTCScene scene_;
@@ -108,18 +324,4 @@ private:
 
 	int done_ = 0;
 	float f_, rendered_ = 0;
-
-	string times_text = "";
-	map<string, float> times;
-	chrono::time_point<chrono::steady_clock> begin();
-	void log(chrono::time_point<chrono::steady_clock>& begin, string prefix);
-	void log(chrono::time_point<chrono::steady_clock>& begin, string prefix, int bump);
-};
-/*typedef Vector3(Raytracer::* Shader)(RTCRayHitModel&, const float&);
-const Shader shaders[5] = {
-	&Raytracer::shader_normal,
-	&Raytracer::shader_light,
-	&Raytracer::shader_shadow,
-	&Raytracer::shader_lambert,
-	&Raytracer::shader_phong
-};*/
\ No newline at end of file
+};
\ No newline at end of file
@@ -1,13 +1,18 @@
 #include "stdafx.h"
 #include "simpleguidx11.h"
 #include "SrgbTransform.h"
+#include "profiler.h"
+#include "perfcounters.h"
+#include "arena.h"
 
-SimpleGuiDX11::SimpleGuiDX11( const int width, const int height)
+SimpleGuiDX11::SimpleGuiDX11( const int width, const int height, const bool headless )
 {
 	width_ = width;
 	height_ = height;
+	headless_ = headless;
 
 	accumulator = new float[width_ * height_ * 4];
+	memset( accumulator, 0, width_ * height_ * 4 * sizeof( float ) );
 	n = 0.f;
 
 	Init();
@@ -16,6 +21,11 @@ SimpleGuiDX11::SimpleGuiDX11( const int width, const int height)
 int SimpleGuiDX11::Init()
 {
 	FreeImage_Initialise();
+
+	// no window, passes are rendered by RenderHeadless
+	if ( headless_ )
+		return 0;
+
 	// Create application window
 	wc_ = { sizeof( WNDCLASSEX ), CS_CLASSDC, s_WndProc, 0L, 0L,
 		GetModuleHandle( NULL ), NULL, NULL, NULL, NULL, _T( "ImGui Example" ), NULL };
@@ -50,7 +60,7 @@ int SimpleGuiDX11::Init()
 	ImGui::StyleColorsDark();
 	//ImGui::StyleColorsClassic();
 
-	tex_data_ = new float[width_ * height_ * 4 * sizeof( float )];	
+	framebuffer_.Resize( width_, height_ );
 	CreateTexture();
 
 	return 0;
@@ -59,15 +69,17 @@ int SimpleGuiDX11::Init()
 SimpleGuiDX11::~SimpleGuiDX11()
 {
 	Cleanup();
-	 
-	delete[] tex_data_;
-	tex_data_ = nullptr;
 }
 
 int SimpleGuiDX11::Cleanup()
 {
+	// queued frames still need FreeImage
+	writer_.Flush();
 	FreeImage_DeInitialise();
 
+	if ( headless_ )
+		return 0;
+
 	ImGui_ImplDX11_Shutdown();
 	ImGui_ImplWin32_Shutdown();
 	ImGui::DestroyContext();
@@ -90,24 +102,259 @@ Color4f SimpleGuiDX11::get_pixel( const int x, const int y, const float t )
 	return Color4f{ 1.0f, 0.0f, 1.0f, 1.0f };
 }
 
+// called by the producer before every pass
+void SimpleGuiDX11::begin_frame()
+{
+}
+
+// called by the producer after every pass
+void SimpleGuiDX11::end_frame()
+{
+}
+
+// called after the rendering is saved, prefix is the file name without extension
+void SimpleGuiDX11::save_extra(const char * prefix)
+{
+}
+
+unsigned long long SimpleGuiDX11::settings_hash() const
+{
+	const int size[2] = { width_, height_ };
+	return HashBytes(size, sizeof(size));
+}
+
+// derived classes add the state of their sample generators
+void SimpleGuiDX11::store_state(Checkpoint & checkpoint) const
+{
+	checkpoint.width = width_;
+	checkpoint.height = height_;
+	checkpoint.settings = settings_hash();
+	checkpoint.samples = n;
+	checkpoint.film.assign(accumulator, accumulator + width_ * height_ * 4);
+}
+
+void SimpleGuiDX11::restore_state(const Checkpoint & checkpoint)
+{
+	n = checkpoint.samples;
+	memcpy(accumulator, checkpoint.film.data(), checkpoint.film.size() * sizeof(float));
+}
+
+// the base class traces no rays of its own
+RayStats * SimpleGuiDX11::ray_stats()
+{
+	return nullptr;
+}
+
+// continues from the checkpoint file when it was written with the current settings
+bool SimpleGuiDX11::Resume()
+{
+	Checkpoint checkpoint;
+	if (!checkpoint.Read(checkpoint_file_.c_str()))
+		return false;
+
+	if (checkpoint.width != width_ || checkpoint.height != height_ || checkpoint.settings != settings_hash())
+	{
+		printf("checkpoint %s has different settings, starting over\n", checkpoint_file_.c_str());
+		return false;
+	}
+
+	restore_state(checkpoint);
+	printf("resumed %s, %d samples\n", checkpoint_file_.c_str(), (int)n);
+	return true;
+}
+
+void SimpleGuiDX11::WriteCheckpoint()
+{
+	Checkpoint checkpoint;
+	store_state(checkpoint);
+	checkpoints_.Submit(std::move(checkpoint), checkpoint_file_);
+}
+
 void SimpleGuiDX11::sample(int x, int y, float t, Color4f* result)
 {
 	*result = get_pixel(x, y, t);
 }
 
+void SimpleGuiDX11::sample_row(const int y, const float t, Color4f* result)
+{
+	#pragma omp parallel
+	{
+		PROFILE_ZONE( kZonePixel );
+		PERF_RAY_STAGE( kStagePixel, ray_stats() );
+		#pragma omp for schedule(dynamic)
+		for (int x0 = 0; x0 < width_; x0 += kCancelPixels)
+		{
+			if (restart_pending())
+				continue;
+			for (int x = x0; x < min(x0 + kCancelPixels, width_); ++x)
+				result[x] = get_pixel(x, y, t);
+		}
+	}
+}
+
+bool SimpleGuiDX11::restart_pending() const
+{
+	return restart_request_.load( std::memory_order_acquire );
+}
+
 float Prepare(float color)
 {
 	return SrgbTransform::linearToSrgb(SrgbTransform::tonemap(color));
 }
 
+Color4f SimpleGuiDX11::preview_pixel( const int x, const int y, const float t )
+{
+	return get_pixel( x, y, t );
+}
+
+// renders one pixel out of step x step and interpolates the displayed image from them,
+// returns false when a restart cancels the preview
+bool SimpleGuiDX11::Preview( const int step, const float t )
+{
+	const int columns = ( width_ + step - 1 ) / step;
+	const int rows = ( height_ + step - 1 ) / step;
+	Color4f * coarse = ScratchArena().NewArray<Color4f>( columns * rows );
+
+	for ( int j = 0; j < rows; ++j )
+	{
+		if ( restart_request_.load( std::memory_order_acquire ) )
+			return false;
+
+		#pragma omp parallel for
+		for ( int i = 0; i < columns; ++i )
+			coarse[j * columns + i] = preview_pixel( i * step, j * step, t );
+	}
+
+	// bilinear upsampling, pixels past the last sample repeat it
+	for ( int y = 0; y < height_; ++y )
+	{
+		const int j0 = y / step, j1 = min( j0 + 1, rows - 1 );
+		const float v = float( y - j0 * step ) / step;
+		float * display = framebuffer_.row( y );
+
+		#pragma omp parallel for
+		for ( int x = 0; x < width_; ++x )
+		{
+			const int i0 = x / step, i1 = min( i0 + 1, columns - 1 );
+			const float u = float( x - i0 * step ) / step;
+			const Color4f & c00 = coarse[j0 * columns + i0];
+			const Color4f & c01 = coarse[j0 * columns + i1];
+			const Color4f & c10 = coarse[j1 * columns + i0];
+			const Color4f & c11 = coarse[j1 * columns + i1];
+			const float w00 = ( 1 - u ) * ( 1 - v ), w01 = u * ( 1 - v ), w10 = ( 1 - u ) * v, w11 = u * v;
+
+			display[x * 4] = Prepare( c00.r * w00 + c01.r * w01 + c10.r * w10 + c11.r * w11 );
+			display[x * 4 + 1] = Prepare( c00.g * w00 + c01.g * w01 + c10.g * w10 + c11.g * w11 );
+			display[x * 4 + 2] = Prepare( c00.b * w00 + c01.b * w01 + c10.b * w10 + c11.b * w11 );
+			display[x * 4 + 3] = Prepare( c00.a * w00 + c01.a * w01 + c10.a * w10 + c11.a * w11 );
+		}
+	}
+
+	return true;
+}
+
+void SimpleGuiDX11::accumulate_row(const int y, const Color4f* row)
+{
+	if (!accumulator_)
+		return;
+
+	const float n1 = n + 1, _1_n = 1.f / n1;
+
+	#pragma omp parallel
+	{
+		PERF_STAGE( kStageAccumulate );
+		#pragma omp for
+		for (int x = 0; x < width_; ++x)
+		{
+			const Color4f pixel = row[x];
+			const int offset = (y * width_ + x) * 4;
+
+			accumulator[offset + 0] = (pixel.r + accumulator[offset + 0] * n) * _1_n;
+			accumulator[offset + 1] = (pixel.g + accumulator[offset + 1] * n) * _1_n;
+			accumulator[offset + 2] = (pixel.b + accumulator[offset + 2] * n) * _1_n;
+			accumulator[offset + 3] = (pixel.a + accumulator[offset + 3] * n) * _1_n;
+		}
+	}
+}
+
+int SimpleGuiDX11::RenderHeadless(const int passes)
+{
+	Color4f * row = new Color4f[width_];
+	const float t = 0.0f; // fixed time keeps passes reproducible
+
+	for (int pass = 0; pass < passes; ++pass)
+	{
+		current_ = 0;
+		NextScratchPass();
+		begin_frame();
+		Profiler::Instance().FrameBoundary();
+
+		for (int y = 0; y < height_; ++y)
+		{
+			sample_row(y, t, row);
+			accumulate_row(y, row);
+			current_++;
+		}
+
+		if (accumulator_)
+			n++;
+		end_frame();
+	}
+
+	delete[] row;
+	return 0;
+}
+
+void SimpleGuiDX11::Resize( const int width, const int height )
+{
+	width_ = width;
+	height_ = height;
+
+	delete[] accumulator;
+	accumulator = new float[width_ * height_ * 4];
+	ClearAccumulator();
+}
+
+void SimpleGuiDX11::ClearAccumulator()
+{
+	n = 0;
+	memset( accumulator, 0, width_ * height_ * 4 * sizeof( float ) );
+}
+
+void SimpleGuiDX11::Restart()
+{
+	restart_request_.store( true, std::memory_order_release );
+}
+
+const float * SimpleGuiDX11::image() const
+{
+	return accumulator;
+}
+
 void SimpleGuiDX11::Producer()
 {
-	float * local_data = new float[width_*height_ * 4];
-	int pixel_size = 24;
-	FIBITMAP* bitmap = FreeImage_Allocate(width_, height_, pixel_size);
+	// linear values of the last pass, saved instead of the accumulator when it is off
+	float * pass_data = new float[width_*height_ * 4];
+	Color4f * row = new Color4f[width_];
 
 	float t = 0.0f; // time
 	auto t0 = std::chrono::high_resolution_clock::now();
+	auto published = t0;
+	auto checkpointed = t0;
+
+	if (checkpoint_ && resume_ && accumulator_)
+		Resume();
+
+	// rows of the first full resolution pass after a preview, every kInterleave-th row first and the gaps bisected
+	std::vector<int> interleaved_rows;
+	const int offsets[kInterleave] = { 0, 2, 1, 3 };
+	for ( const int offset : offsets )
+		for ( int y = offset; y < height_; y += kInterleave )
+			interleaved_rows.push_back( y );
+
+	int preview_level = ( preview_ && n == 0 ) ? kPreviewLevels : 0;
+	bool interleaved = false;
+	bool partial = false; // the accumulator holds rows of a pass that did not finish
 
 	// refinenment loop
 	//for ( float t = 0.0f; t < 1e+3 && !finish_request_.load( std::memory_order_acquire ); t += float( 1e-1 ) )
@@ -117,85 +364,160 @@ void SimpleGuiDX11::Producer()
 		auto t1 = std::chrono::high_resolution_clock::now();
 		running_ = t1 - t0;
 		t += running_.count();
+		// samples of the old settings must not be averaged with the new ones
+		if ( restart_request_.exchange( false, std::memory_order_acq_rel ) )
+		{
+			ClearAccumulator();
+			partial = false;
+			preview_level = preview_ ? kPreviewLevels : 0;
+		}
+		// scratch memory of the previous pass is no longer referenced
+		NextScratchPass();
+		begin_frame();
+		Profiler::Instance().FrameBoundary();
+
+		// previews are neither accumulated nor counted as passes, a restart during them starts over
+		if ( preview_level > 0 )
+		{
+			// a cancelled preview is incomplete, the restart handling above starts the previews over
+			if ( !Preview( 1 << preview_level, t ) )
+			{
+				t0 = t1;
+				continue;
+			}
+			framebuffer_.Publish();
+			published = std::chrono::high_resolution_clock::now();
+			t0 = t1;
+			if ( --preview_level == 0 )
+				interleaved = true;
+			continue;
+		}
 
 		// compute rendering
 		//std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
-		//#pragma omp parallel for collapse(2) shared(local_data) shared(bitmap) shared(t0) shared(t)
-		for ( int y = 0; y < height_; ++y )
+		//#pragma omp parallel for collapse(2) shared(t0) shared(t)
+		bool cancelled = false;
+		partial = accumulator_;
+		for ( int i = 0; i < height_; ++i )
 		{
+			// the preview stays visible in the rows not rendered yet
+			const int y = interleaved ? interleaved_rows[i] : i;
+
+			// a pass with stale settings ends before the next row, sample_row abandons the current one
+			if ( restart_request_.load( std::memory_order_acquire ) )
+			{
+				cancelled = true;
+				break;
+			}
+
 			/*#pragma omp critical
 			{*/
 				auto t2 = std::chrono::high_resolution_clock::now();
 				lastFrame_ = t2 - t0;
 			//}
 
-			#pragma omp parallel for shared(t) shared(local_data) shared(bitmap)
-			for ( int x = 0; x < width_; ++x )
-			{	
-				const Color4f pixel = get_pixel( x, y, t );
-				const int offset = ( y * width_ + x ) * 4;
-
-				if (accumulator_)
-				{
-					float n1 = n + 1, _1_n = 1.f / n1;
-
-					accumulator[offset + 0] = (pixel.r + accumulator[offset + 0] * n) * _1_n;
-					accumulator[offset + 1] = (pixel.g + accumulator[offset + 1] * n) * _1_n;
-					accumulator[offset + 2] = (pixel.b + accumulator[offset + 2] * n) * _1_n;
-					accumulator[offset + 3] = (pixel.a + accumulator[offset + 3] * n) * _1_n;
-
-					local_data[offset] = Prepare(accumulator[offset]);
-					local_data[offset + 1] = Prepare(accumulator[offset + 1]);
-					local_data[offset + 2] = Prepare(accumulator[offset + 2]);
-					local_data[offset + 3] = Prepare(accumulator[offset + 3]);
-				}
-				else
-				{
-					local_data[offset] = Prepare(pixel.r);
-					local_data[offset + 1] = Prepare(pixel.g);
-					local_data[offset + 2] = Prepare(pixel.b);
-					local_data[offset + 3] = Prepare(pixel.a);
-				}
+			{
+				PROFILE_ZONE( kZoneRow );
+				sample_row( y, t, row );
+			}
 
+			// the row may have been abandoned part way, it is neither accumulated nor shown
+			if ( restart_pending() )
+			{
+				cancelled = true;
+				break;
+			}
 
-				//if (save_)
-				//{
-					RGBQUAD color;
-					color.rgbBlue = local_data[offset+2] * 255.f;
-					color.rgbGreen = local_data[offset+1] * 255.f;
-					color.rgbRed = local_data[offset] * 255.f;
-					color.rgbReserved = local_data[offset+3] * 255.f;
-					FreeImage_SetPixelColor(bitmap, x, height_ - y, &color);
-				//}
+			{
+				PROFILE_ZONE( kZoneAccumulate );
+				accumulate_row( y, row );
+
+				const float * film = accumulator_ ? accumulator : pass_data;
+				if (!accumulator_)
+					memcpy( &pass_data[y * width_ * 4], row, width_ * sizeof( Color4f ) );
+
+				float * display = framebuffer_.row( y );
+				#pragma omp parallel for
+				for ( int x = 0; x < width_; ++x )
+				{	
+					const int offset = ( y * width_ + x ) * 4;
+
+					display[x * 4] = Prepare(film[offset]);
+					display[x * 4 + 1] = Prepare(film[offset + 1]);
+					display[x * 4 + 2] = Prepare(film[offset + 2]);
+					display[x * 4 + 3] = Prepare(film[offset + 3]);
+				}
 			}
 
 			//#pragma omp atomic
 			current_ ++;
 
+			// show finished rows before the pass ends
+			if ( t2 - published > std::chrono::duration<float>( publish_interval_ ) )
+			{
+				framebuffer_.Publish();
+				published = t2;
+			}
+
 		}
+		t0 = t1;
+		if ( cancelled )
+		{
+			// the partially accumulated pass is cleared by the restart
+			framebuffer_.Publish();
+			continue;
+		}
+
+		interleaved = false;
+		partial = false;
 		if(accumulator_)
 			n++;
 			//n = min(n++, accumulator_n_);
-		t0 = t1;
+		end_frame();
+
+		// passes are complete here, the copy is written in the background
+		if (checkpoint_ && accumulator_ && n > 0 &&
+			std::chrono::high_resolution_clock::now() - checkpointed > std::chrono::duration<float>(checkpoint_interval_))
+		{
+			WriteCheckpoint();
+			checkpointed = std::chrono::high_resolution_clock::now();
+		}
 
 		// write rendering results
 		{
 			if (save_)
 			{
-				char path[100];
-				sprintf(path, "screens/%d_%d.bmp", clock(), (int)n);
-				printf("saving %s\n", path);
-				FreeImage_Save(FIF_PNG, bitmap, path, PNG_DEFAULT);
+				// only the copy is made here, conversion and disk I/O run on the writer thread
+				PROFILE_ZONE( kZoneSave );
+				const float * film = accumulator_ ? accumulator : pass_data;
+				char prefix[100];
+				sprintf(prefix, "screens/%d_%d", clock(), (int)n);
+				printf("saving %s%s\n", prefix, ImageWriter::extension(static_cast<ImageFormat>(save_format_)));
+
+				ImageWriter::Job job;
+				job.rgba.assign(film, film + width_ * height_ * 4);
+				job.width = width_;
+				job.height = height_;
+				job.file_name = prefix;
+				job.format = static_cast<ImageFormat>(save_format_);
+				job.display = false;
+				writer_.Submit(std::move(job));
+				save_extra(prefix);
 			}
-			std::lock_guard<std::mutex> lock( tex_data_lock_ );
-			memcpy( tex_data_, local_data, width_ * height_ * 4 * sizeof( float ) );		
+			framebuffer_.Publish();
+			published = std::chrono::high_resolution_clock::now();
 			//n++;
 			//n = min(n++, 10);
-		} // lock release
+		}
 
 	}
 
-	delete[] local_data;
+	// a cancelled pass left the accumulator half blended and a pending restart has new settings
+	if (checkpoint_ && accumulator_ && n > 0 && !partial && !restart_pending())
+		WriteCheckpoint();
+
+	delete[] row;
+	delete[] pass_data;
 	//delete[] bytes;
 }
 
@@ -249,15 +571,16 @@ int SimpleGuiDX11::MainLoop()
 
 		Ui();
 
+		// upload only when the producer published a newer image
+		bool fresh = false;
+		const float * image = framebuffer_.Acquire( &fresh );
+		if ( fresh )
 		{
 			D3D11_MAPPED_SUBRESOURCE mapped;
 			ZeroMemory( &mapped, sizeof( mapped ) );
 			HRESULT hr = g_pd3dDeviceContext->Map( tex_id_, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped ); // D3D11_MAP_WRITE, D3D11_MAP_WRITE_DISCARD
 
-			{
-				std::lock_guard<std::mutex> lock( tex_data_lock_ );
-				memcpy( mapped.pData, tex_data_, mapped.RowPitch * height_ );
-			}
+			memcpy( mapped.pData, image, mapped.RowPitch * height_ );
 			
 			g_pd3dDeviceContext->Unmap( tex_id_, 0 );
 		}
@@ -381,7 +704,7 @@ HRESULT SimpleGuiDX11::CreateTexture()
 		// set up initial data description for the texture
 		D3D11_SUBRESOURCE_DATA initData;
 		ZeroMemory( &initData, sizeof( initData ) );
-		initData.pSysMem = ( void * )tex_data_;
+		initData.pSysMem = ( void * )framebuffer_.Acquire();
 		initData.SysMemPitch = width_ * ( 4 * sizeof( float ) );
 		initData.SysMemSlicePitch = height_ * initData.SysMemPitch;
 
@@ -2,19 +2,39 @@
 #include "simpleguidx11.h"
 #include "structs.h"
 #include "time.h"
+#include "imagewriter.h"
+#include "framebuffer.h"
+#include "checkpoint.h"
 #include <FreeImage.h>
 #include <fstream>
 
+class RayStats;
+
 class SimpleGuiDX11
 {
 public:	
-	SimpleGuiDX11( const int width, const int height );	
+	SimpleGuiDX11( const int width, const int height, const bool headless = false );	
 	~SimpleGuiDX11();		
 	
 	int MainLoop();
+	// renders the given number of passes on the calling thread without any window
+	int RenderHeadless( const int passes );
+	// accumulated linear RGBA image, width * height * 4 floats
+	const float * image() const;
+	// hash of every setting that changes the rendered image, checkpoints or workers with other settings are refused
+	virtual unsigned long long settings_hash() const;
+	// new image size, only without a window, clears the accumulator
+	void Resize( const int width, const int height );
+	void ClearAccumulator();
+	// called from the UI thread, the running pass stops within kCancelPixels pixels and the accumulator is cleared before the next one
+	void Restart();
+
+	int width() const;
+	int height() const;
 
 	//int accumulator_n_{ 10 };
 	bool accumulator_{ true };
+	bool resume_{ false }; // continue from checkpoint_file_ at start, checkpoints are written either way
 
 protected:
 	int Init();
@@ -33,17 +53,40 @@ protected:
 	virtual Color4f get_pixel( const int x, const int y, const float t = 0.0f );
 
 	void sample(int x, int y, float t, Color4f * result);
+	virtual void sample_row(const int y, const float t, Color4f * result);
+	// cheap single sample used by the preview, the default is the full pixel
+	virtual Color4f preview_pixel( const int x, const int y, const float t );
+	virtual void begin_frame();
+	virtual void end_frame();
+	virtual void save_extra(const char * prefix);
+	virtual void store_state(Checkpoint & checkpoint) const;
+	virtual void restore_state(const Checkpoint & checkpoint);
+	// rays traced by the render threads, the hardware counters attribute them to the pixel stage
+	virtual RayStats * ray_stats();
+	bool Resume();
+	void WriteCheckpoint();
 
 	void Producer();
+	// true while a restart waits for the pass to end, sample_row checks it every kCancelPixels pixels and abandons the row
+	bool restart_pending() const;
+	static const int kCancelPixels = 16;
+	bool Preview( const int step, const float t );
+	void accumulate_row( const int y, const Color4f * row );
 
-	int width() const;
-	int height() const;
 	int current() const;
 	float progress() const;
 
+	bool headless_{ false };
 	bool vsync_{ true };
 	bool debug_{ false };
 	bool save_{ false };
+	bool preview_{ true }; // coarse images after every restart before the full resolution passes
+	int save_format_{ kImagePng8 };
+	ImageWriter writer_;
+	bool checkpoint_{ true };
+	float checkpoint_interval_{ 60.0f }; // seconds between checkpoints
+	std::string checkpoint_file_{ "checkpoint.pg1c" };
+	CheckpointWriter checkpoints_;
 	std::chrono::duration<float> lastFrame_;
 	std::chrono::duration<float> running_;
 
@@ -64,8 +107,11 @@ private:
 	int width_{ 640 };
 	int height_{ 480 };
 	int current_{ 0 };
-	float * tex_data_{ nullptr }; // DXGI_FORMAT_R32G32B32A32_FLOAT
-	std::mutex tex_data_lock_;
+	FrameBuffer framebuffer_; // DXGI_FORMAT_R32G32B32A32_FLOAT
+	float publish_interval_{ 1.0f / 30.0f }; // seconds between partial updates of the displayed image
+	static const int kPreviewLevels = 2; // previews sample 1/16 and then 1/4 of the pixels
+	static const int kInterleave = 4; // the first full resolution pass renders every kInterleave-th row first
 		
 	std::atomic<bool> finish_request_{ false };	
+	std::atomic<bool> restart_request_{ false };
 };
@@ -1,7 +1,8 @@
 #include "stdafx.h"
 #include "surface.h"
+#include "arena.h"
 
-Surface * BuildSurface( const std::string & name, std::vector<Vertex> & face_vertices )
+Surface * BuildSurface( const std::string & name, std::vector<Vertex> & face_vertices, Arena * arena )
 {
 	const int no_vertices = static_cast< int >( face_vertices.size() );
 
@@ -9,7 +10,7 @@ Surface * BuildSurface( const std::string & name, std::vector<Vertex> & face_ver
 
 	const int no_triangles = no_vertices / 3;
 
-	Surface * surface = new Surface( name, no_triangles );
+	Surface * surface = arena != nullptr ? arena->New<Surface>( name, no_triangles, *arena ) : new Surface( name, no_triangles );
 
 	// koprovn dat
 	for ( int i = 0; i < no_triangles; ++i )
@@ -37,9 +38,20 @@ Surface::Surface( const std::string & name, const int n )
 	triangles_ = new Triangle[n_];
 }
 
+Surface::Surface( const std::string & name, const int n, Arena & arena )
+{
+	assert( n > 0 );
+
+	name_ = name;
+
+	n_ = n;
+	triangles_ = arena.NewArray<Triangle>( n_ );
+	owns_triangles_ = false;
+}
+
 Surface::~Surface()
 {
-	if ( triangles_ )
+	if ( triangles_ && owns_triangles_ )
 	{
 		delete[] triangles_;
 		triangles_ = nullptr;
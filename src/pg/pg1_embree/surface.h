@@ -5,6 +5,8 @@
 #include "material.h"
 #include "triangle.h"
 
+class Arena;
+
 /*! \class Surface
 \brief A class representing a triangular mesh.
 
@@ -30,6 +32,12 @@ public:
 	*/
 	Surface( const std::string & name, const int n );
 
+	//! Constructor of a surface whose triangles are allocated from \a arena.
+	/*!
+	The triangles are released together with the arena, not by the destructor.
+	*/
+	Surface( const std::string & name, const int n, Arena & arena );
+
 	//! Destruktor.
 	/*!
 	Uvoln vechny alokovan zdroje.
@@ -83,6 +91,7 @@ protected:
 
 private:
 	int n_{ 0 }; /*!< Poet trojhelnk v sti. */
+	bool owns_triangles_{ true }; /*!< False when the triangles belong to an arena. */
 	Triangle * triangles_{ nullptr }; /*!< Trojhelnkov s. */
 
 	std::string name_{ "unknown" }; /*!< Nzev plochy. */
@@ -91,11 +100,12 @@ private:
 	Material * material_{ nullptr }; /*!< Materil plochy. */
 };
 
-/*! \fn Surface * BuildSurface( const std::string & name, std::vector<Vertex> & face_vertices )
+/*! \fn Surface * BuildSurface( const std::string & name, std::vector<Vertex> & face_vertices, Arena * arena )
 \brief Sestaven plochy z pole trojic vrchol.
 \param name nzev plochy.
 \param face_vertices pole trojic vrchol.
+\param arena arena owning the surface and its triangles, nullptr allocates them on the heap.
 */
-Surface * BuildSurface( const std::string & name, std::vector<Vertex> & face_vertices );
+Surface * BuildSurface( const std::string & name, std::vector<Vertex> & face_vertices, Arena * arena = nullptr );
 
 #endif
@@ -1,7 +1,7 @@
 #include "stdafx.h"
 #include "texture.h"
 
-Texture::Texture( const char * file_name )
+Texture::Texture( const char * file_name ) : file_name_( file_name )
 {
 	// image format
 	FREE_IMAGE_FORMAT fif = FIF_UNKNOWN;
@@ -89,3 +89,8 @@ int Texture::height() const
 {
 	return height_;
 }
+
+const std::string & Texture::file_name() const
+{
+	return file_name_;
+}
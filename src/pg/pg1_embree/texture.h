@@ -21,6 +21,7 @@ public:
 
 	int width() const;
 	int height() const;
+	const std::string & file_name() const;
 
 private:	
 	int width_{ 0 }; // image width (px)
@@ -28,6 +29,7 @@ private:
 	int scan_width_{ 0 }; // size of image row (bytes)
 	int pixel_size_{ 0 }; // size of each pixel (bytes)
 	BYTE * data_{ nullptr }; // image data in BGR format
+	std::string file_name_;
 };
 
 #endif